@@ -0,0 +1,282 @@
+#ifndef ADAPTIVE_SUBDIVISION_HPP
+#define ADAPTIVE_SUBDIVISION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include "Eigen"
+#include "Types.hpp"
+#include "Lights.hpp"
+#include "Mesh.hpp"
+#include "IndexedMesh.hpp"
+#include "Instance.hpp"
+#include "ThreadPool.hpp"
+#include "LoopSubdivision.hpp"
+
+/** Configuration of SubdivisionCache; see Scene::setSubdivisionSettings. */
+struct SubdivisionSettings {
+    bool enabled{false};
+    double maxEdgePixels{8};  // faces with a longer projected edge are refined
+    size_t maxLevels{3};      // Loop steps at most, each halving edge lengths
+    size_t maxPatches{64};    // least recently used patches are evicted
+};
+
+/** The refined part of one copy: the triangles of its Object's IndexedMesh
+    that it replaces, and the Loop subdivided surface drawn in their place. */
+struct SubdivisionPatch {
+    std::vector<char> baseMarks;  // base triangles refined at the first level
+    size_t levels{0};             // Loop steps the view called for
+    bool failed{false};           // the mesh is not an orientable manifold
+    std::vector<char> hidden;     // per base triangle, replaced by 'mesh'
+    IndexedMesh mesh;
+};
+
+/**
+ * Adaptive Loop subdivision of close-up object copies. Triangles whose
+ * projected edges are longer than 'maxEdgePixels' are refined, repeatedly
+ * up to 'maxLevels' times, and only the region they affect is kept: as a
+ * patch per copy, drawn together with the rest of the unrefined mesh. A
+ * patch is reused while the same base triangles need refining by the same
+ * number of levels, so small camera moves do not rebuild it.
+ *
+ * Copies of eagerly loaded objects are refined where the software renderer
+ * draws them, in object space. Normals of the patch are recomputed from the
+ * subdivided surface.
+*/
+class SubdivisionCache {
+public:
+    struct Stats {
+        size_t draws;
+        size_t builds;
+    };
+
+    void setSettings(const SubdivisionSettings& settings_) {
+        settings = settings_;
+        clear();
+    }
+
+    const SubdivisionSettings& getSettings() const {
+        return settings;
+    }
+
+    Stats getStats() const {
+        return stats;
+    }
+
+    void clear() {
+        lru.clear();
+        entries.clear();
+    }
+
+    /**
+     * Draws 'copy' with its close-up triangles subdivided.
+     * @return false if no triangle needs refining, or the object cannot be
+     *         subdivided; the caller draws it as usual.
+    */
+    bool draw(const Instance& copy, ShadingAlgo alg,
+              std::vector<PointLight>& lights, Vertex& cameraPos,
+              Eigen::Matrix4d& worldToHomoNDC,
+              std::vector<std::vector<Color>>& screenGrid,
+              std::vector<std::vector<double>>& minDepth,
+              size_t xres, size_t yres) {
+        std::shared_ptr<const IndexedMesh> base = copy.getObject().getIndexedMesh();
+        if (!base) {
+            return false;
+        }
+        std::vector<Vertex> positions(base->vertices.size());
+        for (size_t i = 0; i < positions.size(); i++) {
+            positions[i] = base->vertices[i].position();
+        }
+        std::vector<char> marks;
+        double longest = markFaces(positions.data(), base->indices.data(),
+                                   base->numFaces(), worldToHomoNDC, xres, yres, marks);
+        if (longest <= settings.maxEdgePixels) {
+            return false;
+        }
+        size_t levels = std::min<size_t>(settings.maxLevels,
+            (size_t) std::ceil(std::log2(longest / settings.maxEdgePixels)));
+
+        auto it = entries.find(&copy);
+        if (it != entries.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+        } else {
+            lru.push_front({&copy, SubdivisionPatch{}});
+            it = entries.emplace(&copy, lru.begin()).first;
+            while (lru.size() > settings.maxPatches) {
+                entries.erase(lru.back().copy);
+                lru.pop_back();
+            }
+        }
+        SubdivisionPatch& patch = it->second->patch;
+        if (patch.baseMarks != marks || patch.levels != levels) {
+            patch.baseMarks.swap(marks);
+            patch.levels = levels;
+            build(patch, *base, worldToHomoNDC, xres, yres);
+            stats.builds++;
+        }
+        if (patch.failed) {
+            return false;
+        }
+
+        const Object& object = copy.getObject();
+        object.renderShadedObj(copy.material, screenGrid, xres, yres, alg, lights,
+                               cameraPos, worldToHomoNDC, minDepth, 0, &patch.hidden);
+        object.renderShadedMesh(patch.mesh, copy.material, screenGrid, xres, yres,
+                                alg, lights, cameraPos, worldToHomoNDC, minDepth);
+        stats.draws++;
+        return true;
+    }
+
+private:
+    struct Entry {
+        const Instance* copy;
+        SubdivisionPatch patch;
+    };
+
+    /* Sets 'marks' for the triangles in front of the camera and on screen
+       whose longest projected edge exceeds 'maxEdgePixels'.
+       @return The longest such edge in pixels, 0 if there is none. */
+    double markFaces(const Vertex* positions, const uint32_t* indices, size_t numFaces,
+                     const Eigen::Matrix4d& worldToHomoNDC, size_t xres, size_t yres,
+                     std::vector<char>& marks) const {
+        const size_t GRAIN = 1 << 14;
+        marks.assign(numFaces, false);
+        std::vector<double> longest(numFaces, 0);
+        ThreadPool::shared().parallelFor(numFaces, GRAIN, [&](size_t lo, size_t hi) {
+            for (size_t f = lo; f < hi; f++) {
+                double px[3], py[3];
+                bool visible = true;
+                double xmin = 1, xmax = -1, ymin = 1, ymax = -1;
+                for (int k = 0; k < 3; k++) {
+                    const Vertex& v = positions[indices[3*f + k]];
+                    Eigen::Vector4d h = worldToHomoNDC*Eigen::Vector4d(v.x, v.y, v.z, 1);
+                    if (h(3) <= 0) {
+                        visible = false;
+                        break;
+                    }
+                    double x = h(0)/h(3), y = h(1)/h(3);
+                    xmin = std::min(xmin, x);
+                    xmax = std::max(xmax, x);
+                    ymin = std::min(ymin, y);
+                    ymax = std::max(ymax, y);
+                    px[k] = (x + 1)/2*xres;
+                    py[k] = (y + 1)/2*yres;
+                }
+                if (!visible || xmax < -1 || xmin > 1 || ymax < -1 || ymin > 1) {
+                    continue;
+                }
+                double edge = 0;
+                for (int k = 0; k < 3; k++) {
+                    double dx = px[(k + 1) % 3] - px[k], dy = py[(k + 1) % 3] - py[k];
+                    edge = std::max(edge, std::sqrt(dx*dx + dy*dy));
+                }
+                if (edge > settings.maxEdgePixels) {
+                    marks[f] = true;
+                    longest[f] = edge;
+                }
+            }
+        });
+        return numFaces > 0 ? *std::max_element(longest.begin(), longest.end()) : 0;
+    }
+
+    /* Welds the base mesh by position, takes up to 'patch.levels' Loop
+       steps, refining at each only what is still too long on screen, and
+       keeps the faces descended from base triangles that any step changed. */
+    void build(SubdivisionPatch& patch, const IndexedMesh& base,
+               const Eigen::Matrix4d& worldToHomoNDC, size_t xres, size_t yres) const {
+        const size_t numBase = base.numFaces();
+        Mesh mesh;
+        mesh.vertices.emplace_back();  // dummy vertex for 1-indexing
+        std::unordered_map<uint64_t, std::vector<int>> buckets;
+        std::vector<int> welded(base.vertices.size());
+        for (size_t i = 0; i < base.vertices.size(); i++) {
+            const IndexedVertex& v = base.vertices[i];
+            uint32_t bits[3];
+            std::memcpy(bits, &v.px, sizeof(bits));
+            uint64_t key = bits[0] ^ ((uint64_t) bits[1] << 21) ^ ((uint64_t) bits[2] << 42);
+            int found = 0;
+            for (int j : buckets[key]) {
+                const Vertex& p = mesh.vertices[j];
+                if (p.x == v.px && p.y == v.py && p.z == v.pz) {
+                    found = j;
+                    break;
+                }
+            }
+            if (found == 0) {
+                found = mesh.vertices.size();
+                mesh.vertices.push_back(v.position());
+                buckets[key].push_back(found);
+            }
+            welded[i] = found;
+        }
+        mesh.faces.reserve(numBase);
+        for (size_t f = 0; f < numBase; f++) {
+            int a = welded[base.indices[3*f]], b = welded[base.indices[3*f + 1]],
+                c = welded[base.indices[3*f + 2]];
+            mesh.faces.push_back({{a, b, c}, {a, b, c}});
+        }
+
+        std::vector<uint32_t> root(numBase);  // base triangle of each face
+        for (size_t f = 0; f < numBase; f++) {
+            root[f] = f;
+        }
+        patch.hidden.assign(numBase, false);
+        std::vector<char> marks = patch.baseMarks;
+        std::vector<uint32_t> parent;
+        std::vector<char> changed;
+        for (size_t level = 0; level < patch.levels; level++) {
+            if (level > 0) {
+                std::vector<uint32_t> indices(3*mesh.faces.size());
+                for (size_t f = 0; f < mesh.faces.size(); f++) {
+                    indices[3*f] = mesh.faces[f].v.i1;
+                    indices[3*f + 1] = mesh.faces[f].v.i2;
+                    indices[3*f + 2] = mesh.faces[f].v.i3;
+                }
+                if (markFaces(mesh.vertices.data(), indices.data(), mesh.faces.size(),
+                              worldToHomoNDC, xres, yres, marks) == 0) {
+                    break;
+                }
+            }
+            if (!loopSubdivide(mesh.vertices, mesh.faces, marks, parent, changed)) {
+                std::cerr << "SubdivisionCache: not an orientable manifold, drawn unrefined"
+                          << std::endl;
+                patch.failed = true;
+                return;
+            }
+            std::vector<uint32_t> newRoot(mesh.faces.size());
+            for (size_t f = 0; f < mesh.faces.size(); f++) {
+                newRoot[f] = root[parent[f]];
+                if (changed[f]) {
+                    patch.hidden[newRoot[f]] = true;
+                }
+            }
+            root.swap(newRoot);
+        }
+
+        mesh.normals.assign(1, Vertex{});
+        computeVertexNormals(mesh.normals, mesh.vertices, mesh.faces);
+        Mesh region;
+        region.vertices.swap(mesh.vertices);
+        region.normals.swap(mesh.normals);
+        for (size_t f = 0; f < mesh.faces.size(); f++) {
+            if (patch.hidden[root[f]]) {
+                region.faces.push_back(mesh.faces[f]);
+            }
+        }
+        patch.mesh = makeIndexedMesh(region);
+        patch.mesh.buildMeshlets();
+        patch.failed = false;
+    }
+
+    SubdivisionSettings settings;
+    std::list<Entry> lru;  // most recently used first
+    std::unordered_map<const Instance*, std::list<Entry>::iterator> entries;
+    Stats stats{0, 0};
+};
+
+#endif
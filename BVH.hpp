@@ -0,0 +1,764 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+#include "Eigen"
+#include "Types.hpp"
+#include "Transformations.hpp"
+#include "Instance.hpp"
+#include "ThreadPool.hpp"
+
+/** Axis-aligned box; empty (lo > hi) until something is added. */
+struct AABB {
+    Eigen::Vector3f lo{Eigen::Vector3f::Constant(std::numeric_limits<float>::max())};
+    Eigen::Vector3f hi{Eigen::Vector3f::Constant(-std::numeric_limits<float>::max())};
+
+    void grow(const Eigen::Vector3f& p) {
+        lo = lo.cwiseMin(p);
+        hi = hi.cwiseMax(p);
+    }
+
+    void grow(const AABB& b) {
+        lo = lo.cwiseMin(b.lo);
+        hi = hi.cwiseMax(b.hi);
+    }
+
+    /** @return Half the surface area, 0 if empty; what SAH compares. */
+    float halfArea() const {
+        Eigen::Vector3f d = (hi - lo).cwiseMax(0.0f);
+        return d.x()*d.y() + d.y()*d.z() + d.z()*d.x();
+    }
+
+    Eigen::Vector3f center() const {
+        return 0.5f*(lo + hi);
+    }
+
+    /** @return Squared distance from 'p' to the box, 0 inside it. */
+    float distance2(const Eigen::Vector3f& p) const {
+        Eigen::Vector3f d = (lo - p).cwiseMax(p - hi).cwiseMax(0.0f);
+        return d.squaredNorm();
+    }
+
+    /** @return Entry distance of the ray o + t*d, given 1/d, or infinity if
+     *          it misses the box within [0, tMax]. */
+    float enter(const Eigen::Vector3f& o, const Eigen::Vector3f& invDir, float tMax) const {
+        Eigen::Vector3f t0 = (lo - o).cwiseProduct(invDir);
+        Eigen::Vector3f t1 = (hi - o).cwiseProduct(invDir);
+        float tNear = std::max(0.0f, t0.cwiseMin(t1).maxCoeff());
+        float tFar = std::min(tMax, t0.cwiseMax(t1).minCoeff());
+        return tNear <= tFar ? tNear : std::numeric_limits<float>::infinity();
+    }
+};
+
+/**
+ * Bounding volume hierarchy over primitives known only by their boxes,
+ * built with binned SAH (Wald, "On fast Construction of SAH-based Bounding
+ * Volume Hierarchies"). Nodes are 32 bytes in one array, children after
+ * their parent and next to each other, so refit() is a single reverse
+ * sweep. The top of the tree is split on the calling thread, binning in
+ * parallel, and the subtrees below are built in parallel on
+ * ThreadPool::shared(). Depth is capped so queries run on a fixed stack.
+*/
+class BVH {
+public:
+    static const int NUM_BINS = 16;
+    static const uint32_t MAX_LEAF = 4;   // SAH may stop earlier; see build
+    static const int MAX_DEPTH = 64;
+
+    struct Node {
+        AABB box;
+        uint32_t start;  // inner: first child, the second is start + 1;
+                         // leaf: first entry of 'order'
+        uint32_t count;  // primitives in a leaf, 0 for an inner node
+
+        bool isLeaf() const {
+            return count > 0;
+        }
+    };
+
+    std::vector<Node> nodes;      // nodes[0] is the root
+    std::vector<uint32_t> order;  // primitive ids; leaves own ranges of it
+
+    bool empty() const {
+        return nodes.empty();
+    }
+
+    void build(const std::vector<AABB>& bounds) {
+        const size_t GRAIN = 1 << 14;
+        ThreadPool& pool = ThreadPool::shared();
+        nodes.clear();
+        order.resize(bounds.size());
+        std::iota(order.begin(), order.end(), 0);
+        if (bounds.empty()) {
+            return;
+        }
+        centroids.resize(bounds.size());
+        pool.parallelFor(bounds.size(), GRAIN, [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i++) {
+                centroids[i] = bounds[i].center();
+            }
+        });
+
+        // Ranges this small become subtrees built by one task each
+        size_t taskSize = std::max<size_t>(1 << 12, bounds.size() / (4*pool.size()));
+        std::vector<Range> tasks;
+        std::vector<Range> stack{{0, 0, (uint32_t) bounds.size(), 0}};
+        nodes.push_back({});
+        while (!stack.empty()) {
+            Range r = stack.back();
+            stack.pop_back();
+            if (r.end - r.begin <= taskSize) {
+                tasks.push_back(r);
+                continue;
+            }
+            split(nodes, r, bounds, stack);
+        }
+
+        std::vector<std::vector<Node>> subtrees(tasks.size());
+        pool.parallelFor(tasks.size(), 1, [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i++) {
+                std::vector<Node>& local = subtrees[i];
+                local.push_back({});
+                std::vector<Range> localStack{{0, tasks[i].begin, tasks[i].end, tasks[i].depth}};
+                while (!localStack.empty()) {
+                    Range r = localStack.back();
+                    localStack.pop_back();
+                    split(local, r, bounds, localStack);
+                }
+            }
+        });
+
+        // Splice each subtree in: its root replaces the task's node, the
+        // rest are appended
+        for (size_t i = 0; i < tasks.size(); i++) {
+            const std::vector<Node>& local = subtrees[i];
+            uint32_t offset = nodes.size() - 1;  // local index 1 lands here + 1
+            for (size_t j = 0; j < local.size(); j++) {
+                Node n = local[j];
+                if (!n.isLeaf()) {
+                    n.start += offset;
+                }
+                if (j == 0) {
+                    nodes[tasks[i].node] = n;
+                } else {
+                    nodes.push_back(n);
+                }
+            }
+        }
+        std::vector<Eigen::Vector3f>().swap(centroids);
+    }
+
+    /** @brief Recomputes every node's box from new primitive 'bounds',
+     *         keeping the tree; queries stay exact, only slower if the
+     *         primitives moved far. */
+    void refit(const std::vector<AABB>& bounds) {
+        for (size_t i = nodes.size(); i-- > 0;) {
+            Node& n = nodes[i];
+            n.box = AABB{};
+            if (n.isLeaf()) {
+                for (uint32_t k = n.start; k < n.start + n.count; k++) {
+                    n.box.grow(bounds[order[k]]);
+                }
+            } else {
+                n.box.grow(nodes[n.start].box);
+                n.box.grow(nodes[n.start + 1].box);
+            }
+        }
+    }
+
+    /**
+     * Visits the primitives whose boxes the ray o + t*d enters before
+     * 'tMax', nearer subtrees first. 'hit(id, tMax)' tests primitive 'id'
+     * and lowers 'tMax' if it is hit closer.
+    */
+    template <typename F>
+    void intersect(const Eigen::Vector3f& o, const Eigen::Vector3f& d, float& tMax,
+                   F&& hit) const {
+        if (nodes.empty()) {
+            return;
+        }
+        Eigen::Vector3f invDir = d.cwiseInverse();
+        uint32_t stack[MAX_DEPTH + 1];
+        int size = 0;
+        if (std::isfinite(nodes[0].box.enter(o, invDir, tMax))) {
+            stack[size++] = 0;
+        }
+        while (size > 0) {
+            const Node& n = nodes[stack[--size]];
+            if (n.isLeaf()) {
+                for (uint32_t k = n.start; k < n.start + n.count; k++) {
+                    hit(order[k], tMax);
+                }
+                continue;
+            }
+            float tLeft = nodes[n.start].box.enter(o, invDir, tMax);
+            float tRight = nodes[n.start + 1].box.enter(o, invDir, tMax);
+            uint32_t nearer = n.start, farther = n.start + 1;
+            if (tRight < tLeft) {
+                std::swap(tLeft, tRight);
+                std::swap(nearer, farther);
+            }
+            if (std::isfinite(tRight)) {
+                stack[size++] = farther;
+            }
+            if (std::isfinite(tLeft)) {
+                stack[size++] = nearer;
+            }
+        }
+    }
+
+    /**
+     * Visits the primitives whose boxes may hold a point closer to 'p'
+     * than sqrt(best2), nearer subtrees first. 'test(id, best2)' measures
+     * primitive 'id' and lowers 'best2' if it is closer. Box distances are
+     * multiplied by 'scale2' before pruning, for callers that measure in a
+     * space stretched by at least sqrt(scale2) relative to the boxes'.
+    */
+    template <typename F>
+    void closest(const Eigen::Vector3f& p, float& best2, F&& test, float scale2 = 1) const {
+        if (nodes.empty()) {
+            return;
+        }
+        uint32_t stack[MAX_DEPTH + 1];
+        int size = 0;
+        stack[size++] = 0;
+        while (size > 0) {
+            const Node& n = nodes[stack[--size]];
+            if (scale2*n.box.distance2(p) >= best2) {
+                continue;
+            }
+            if (n.isLeaf()) {
+                for (uint32_t k = n.start; k < n.start + n.count; k++) {
+                    test(order[k], best2);
+                }
+                continue;
+            }
+            float dLeft = nodes[n.start].box.distance2(p);
+            float dRight = nodes[n.start + 1].box.distance2(p);
+            uint32_t nearer = n.start, farther = n.start + 1;
+            if (dRight < dLeft) {
+                std::swap(nearer, farther);
+            }
+            stack[size++] = farther;
+            stack[size++] = nearer;
+        }
+    }
+
+private:
+    struct Range {
+        uint32_t node;
+        uint32_t begin, end;  // into 'order'
+        uint32_t depth;
+    };
+
+    struct Bin {
+        AABB box;
+        uint32_t count{0};
+    };
+
+    /* Makes 'r' a leaf in 'out', or splits it at the cheapest SAH bin
+       boundary and pushes its two children onto 'stack'. */
+    void split(std::vector<Node>& out, const Range& r, const std::vector<AABB>& bounds,
+               std::vector<Range>& stack) {
+        const size_t GRAIN = 1 << 16;
+        const uint32_t count = r.end - r.begin;
+
+        AABB box, centers;
+        if (count > GRAIN) {
+            size_t numBlocks = (count + GRAIN - 1) / GRAIN;
+            std::vector<AABB> boxes(numBlocks), centerBoxes(numBlocks);
+            ThreadPool::shared().parallelFor(count, GRAIN, [&](size_t lo, size_t hi) {
+                for (size_t i = lo; i < hi; i++) {
+                    boxes[lo / GRAIN].grow(bounds[order[r.begin + i]]);
+                    centerBoxes[lo / GRAIN].grow(centroids[order[r.begin + i]]);
+                }
+            });
+            for (size_t b = 0; b < numBlocks; b++) {
+                box.grow(boxes[b]);
+                centers.grow(centerBoxes[b]);
+            }
+        } else {
+            for (uint32_t i = r.begin; i < r.end; i++) {
+                box.grow(bounds[order[i]]);
+                centers.grow(centroids[order[i]]);
+            }
+        }
+        Node& node = out[r.node];
+        node.box = box;
+        node.start = r.begin;
+        node.count = count;
+        Eigen::Vector3f extent = centers.hi - centers.lo;
+        if (count <= MAX_LEAF || r.depth + 1 >= MAX_DEPTH || extent.maxCoeff() <= 0) {
+            return;  // stays a leaf
+        }
+
+        // Bin centroids on every axis, then sweep for the cheapest boundary
+        Bin bins[3][NUM_BINS];
+        auto binOf = [&](int axis, const Eigen::Vector3f& c) {
+            int b = (int) (NUM_BINS*(c[axis] - centers.lo[axis]) / extent[axis]);
+            return std::clamp(b, 0, NUM_BINS - 1);
+        };
+        auto binRange = [&](uint32_t first, uint32_t last, Bin (&into)[3][NUM_BINS]) {
+            for (uint32_t i = first; i < last; i++) {
+                uint32_t id = order[i];
+                for (int axis = 0; axis < 3; axis++) {
+                    if (extent[axis] <= 0) {
+                        continue;
+                    }
+                    Bin& bin = into[axis][binOf(axis, centroids[id])];
+                    bin.box.grow(bounds[id]);
+                    bin.count++;
+                }
+            }
+        };
+        if (count > GRAIN) {
+            size_t numBlocks = (count + GRAIN - 1) / GRAIN;
+            std::vector<Bin> partial(numBlocks*3*NUM_BINS);
+            ThreadPool::shared().parallelFor(count, GRAIN, [&](size_t lo, size_t hi) {
+                auto& into = *reinterpret_cast<Bin(*)[3][NUM_BINS]>(
+                    &partial[(lo / GRAIN)*3*NUM_BINS]);
+                binRange(r.begin + lo, r.begin + hi, into);
+            });
+            for (size_t b = 0; b < numBlocks; b++) {
+                for (int k = 0; k < 3*NUM_BINS; k++) {
+                    const Bin& from = partial[b*3*NUM_BINS + k];
+                    Bin& to = bins[k / NUM_BINS][k % NUM_BINS];
+                    to.box.grow(from.box);
+                    to.count += from.count;
+                }
+            }
+        } else {
+            binRange(r.begin, r.end, bins);
+        }
+
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1, bestSplit = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            if (extent[axis] <= 0) {
+                continue;
+            }
+            float rightCost[NUM_BINS];
+            AABB right;
+            uint32_t rightCount = 0;
+            for (int b = NUM_BINS - 1; b > 0; b--) {
+                right.grow(bins[axis][b].box);
+                rightCount += bins[axis][b].count;
+                rightCost[b] = right.halfArea()*rightCount;
+            }
+            AABB left;
+            uint32_t leftCount = 0;
+            for (int b = 1; b < NUM_BINS; b++) {
+                left.grow(bins[axis][b - 1].box);
+                leftCount += bins[axis][b - 1].count;
+                float cost = left.halfArea()*leftCount + rightCost[b];
+                if (leftCount > 0 && leftCount < count && cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+        // Leaf if splitting does not pay (traversal costs about one test)
+        float leafCost = box.halfArea()*count;
+        if (bestAxis < 0 || (bestCost + box.halfArea() >= leafCost && count <= 4*MAX_LEAF)) {
+            return;
+        }
+
+        uint32_t* first = order.data() + r.begin;
+        uint32_t* last = order.data() + r.end;
+        uint32_t* middle = std::partition(first, last, [&](uint32_t id) {
+            return binOf(bestAxis, centroids[id]) < bestSplit;
+        });
+        uint32_t mid = r.begin + (middle - first);
+
+        uint32_t left = out.size();
+        out.push_back({});
+        out.push_back({});
+        Node& parent = out[r.node];  // 'node' may have moved
+        parent.start = left;
+        parent.count = 0;
+        stack.push_back({left + 1, mid, r.end, r.depth + 1});
+        stack.push_back({left, r.begin, mid, r.depth + 1});
+    }
+
+    std::vector<Eigen::Vector3f> centroids;  // during build only
+};
+
+/* Moller-Trumbore, both sides. @return true if hit at 0 < t < tMax. */
+inline bool intersectTriangle(const Eigen::Vector3f& o, const Eigen::Vector3f& d,
+                              const Eigen::Vector3f& a, const Eigen::Vector3f& b,
+                              const Eigen::Vector3f& c, float tMax,
+                              float& t, float& u, float& v) {
+    Eigen::Vector3f e1 = b - a, e2 = c - a;
+    Eigen::Vector3f p = d.cross(e2);
+    float det = e1.dot(p);
+    if (std::abs(det) < 1e-12f) {
+        return false;
+    }
+    float invDet = 1 / det;
+    Eigen::Vector3f s = o - a;
+    u = s.dot(p)*invDet;
+    if (u < 0 || u > 1) {
+        return false;
+    }
+    Eigen::Vector3f q = s.cross(e1);
+    v = d.dot(q)*invDet;
+    if (v < 0 || u + v > 1) {
+        return false;
+    }
+    t = e2.dot(q)*invDet;
+    return t > 0 && t < tMax;
+}
+
+/* Point of triangle abc closest to 'p' (Ericson, "Real-Time Collision
+   Detection", 5.1.5). */
+inline Eigen::Vector3f closestOnTriangle(const Eigen::Vector3f& p, const Eigen::Vector3f& a,
+                                         const Eigen::Vector3f& b, const Eigen::Vector3f& c) {
+    Eigen::Vector3f ab = b - a, ac = c - a, ap = p - a;
+    float d1 = ab.dot(ap), d2 = ac.dot(ap);
+    if (d1 <= 0 && d2 <= 0) {
+        return a;
+    }
+    Eigen::Vector3f bp = p - b;
+    float d3 = ab.dot(bp), d4 = ac.dot(bp);
+    if (d3 >= 0 && d4 <= d3) {
+        return b;
+    }
+    float vc = d1*d4 - d3*d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+        return a + d1 / (d1 - d3)*ab;
+    }
+    Eigen::Vector3f cp = p - c;
+    float d5 = ab.dot(cp), d6 = ac.dot(cp);
+    if (d6 >= 0 && d5 <= d6) {
+        return c;
+    }
+    float vb = d5*d2 - d1*d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+        return a + d2 / (d2 - d6)*ac;
+    }
+    float va = d3*d6 - d5*d4;
+    if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+        return b + (d4 - d3) / ((d4 - d3) + (d5 - d6))*(c - b);
+    }
+    float denom = 1 / (va + vb + vc);
+    return a + ab*(vb*denom) + ac*(vc*denom);
+}
+
+/** Triangles as three corners each, and a BVH over them. */
+struct TriangleBVH {
+    std::vector<Eigen::Vector3f> corners;  // 3 per triangle
+    BVH bvh;
+
+    size_t numTriangles() const {
+        return corners.size() / 3;
+    }
+
+    std::vector<AABB> triangleBounds() const {
+        std::vector<AABB> bounds(numTriangles());
+        ThreadPool::shared().parallelFor(bounds.size(), 1 << 14, [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i++) {
+                for (int k = 0; k < 3; k++) {
+                    bounds[i].grow(corners[3*i + k]);
+                }
+            }
+        });
+        return bounds;
+    }
+
+    void build() {
+        bvh.build(triangleBounds());
+    }
+
+    void refit() {
+        bvh.refit(triangleBounds());
+    }
+
+    /** @brief Nearest hit of o + t*d before 'tMax', which it lowers. */
+    bool intersect(const Eigen::Vector3f& o, const Eigen::Vector3f& d, float& tMax,
+                   uint32_t& triangle, float& u, float& v) const {
+        bool found = false;
+        bvh.intersect(o, d, tMax, [&](uint32_t i, float& tBest) {
+            float t, tu, tv;
+            if (intersectTriangle(o, d, corners[3*i], corners[3*i + 1], corners[3*i + 2],
+                                  tBest, t, tu, tv)) {
+                tBest = t;
+                triangle = i;
+                u = tu;
+                v = tv;
+                found = true;
+            }
+        });
+        return found;
+    }
+
+    /**
+     * Point closest to 'p' if nearer than sqrt(best2), which it lowers.
+     * Triangles are measured after 'toSpace' maps their corners, and
+     * 'scale2' is the least squared stretch of that map; see BVH::closest.
+    */
+    template <typename Map>
+    bool closestPoint(const Eigen::Vector3f& boxPoint, const Eigen::Vector3f& p,
+                      Map&& toSpace, float scale2, float& best2,
+                      uint32_t& triangle, Eigen::Vector3f& point) const {
+        bool found = false;
+        bvh.closest(boxPoint, best2, [&](uint32_t i, float& dBest) {
+            Eigen::Vector3f q = closestOnTriangle(p, toSpace(corners[3*i]),
+                                                  toSpace(corners[3*i + 1]),
+                                                  toSpace(corners[3*i + 2]));
+            float d2 = (q - p).squaredNorm();
+            if (d2 < dBest) {
+                dBest = d2;
+                triangle = i;
+                point = q;
+                found = true;
+            }
+        }, scale2);
+        return found;
+    }
+};
+
+/** Nearest intersection found by SceneBVH::intersect. 'face' indexes the
+    triangles of the copy's Object in Object::forEachTriangle order, and
+    (u, v) are barycentric weights of its second and third corners. */
+struct RayHit {
+    size_t copy;
+    size_t face;
+    double t;
+    double u, v;
+};
+
+/** Closest surface point found by SceneBVH::closestPoint, in world space. */
+struct PointHit {
+    size_t copy;
+    size_t face;
+    double distance;
+    Eigen::Vector3d point;
+};
+
+/**
+ * Ray picking and closest-point queries over the triangles of every object
+ * copy, placed in world space by the copy's transformation (where the
+ * OpenGL viewer draws it).
+ *
+ * FLAT builds one BVH over all copies' world-space triangles: the fastest
+ * queries, with memory growing with the number of copies. TWO_LEVEL builds
+ * one BVH per Object, shared by its copies, and a top-level BVH over the
+ * copies' world bounds; rays and points are mapped into each copy's object
+ * space. After transformations change, refit() updates either layout
+ * without rebuilding the tree, and in TWO_LEVEL without touching the
+ * per-Object trees.
+*/
+class SceneBVH {
+public:
+    enum Layout {
+        FLAT,
+        TWO_LEVEL
+    };
+
+    void build(const std::vector<Instance>& copies, Layout layout_ = FLAT) {
+        layout = layout_;
+        meshes.clear();
+        for (const Instance& copy : copies) {
+            const Object* object = &copy.getObject();
+            if (meshes.count(object)) {
+                continue;
+            }
+            auto mesh = std::make_shared<TriangleBVH>();
+            object->forEachTriangle([&](const Vertex* v, const Vertex*) {
+                for (int k = 0; k < 3; k++) {
+                    mesh->corners.emplace_back(v[k].x, v[k].y, v[k].z);
+                }
+            });
+            if (layout == TWO_LEVEL) {
+                mesh->build();
+            }
+            meshes[object] = mesh;
+        }
+
+        placeCopies(copies);
+        if (layout == FLAT) {
+            world.build();
+        } else {
+            top.build(copyBounds);
+        }
+    }
+
+    /** @brief Follows changed copy transformations; 'copies' must be the
+     *         vector build() was given, or one of the same objects. */
+    void refit(const std::vector<Instance>& copies) {
+        placeCopies(copies);
+        if (layout == FLAT) {
+            world.refit();
+        } else {
+            top.refit(copyBounds);
+        }
+    }
+
+    /** @return true, filling 'hit', if the ray 'origin' + t*'direction'
+     *          meets a triangle at 0 < t < 'tMax'. */
+    bool intersect(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction,
+                   RayHit& hit, double tMax = std::numeric_limits<double>::infinity()) const {
+        Eigen::Vector3f o = origin.cast<float>(), d = direction.cast<float>();
+        float tBest = std::min<double>(tMax, std::numeric_limits<float>::max());
+        uint32_t triangle;
+        float u, v;
+        if (layout == FLAT) {
+            if (!world.intersect(o, d, tBest, triangle, u, v)) {
+                return false;
+            }
+            locate(triangle, hit.copy, hit.face);
+            hit = {hit.copy, hit.face, tBest, u, v};
+            return true;
+        }
+
+        bool found = false;
+        top.intersect(o, d, tBest, [&](uint32_t c, float& tCopy) {
+            const Placement& pl = placements[c];
+            // t is the same along the ray mapped to object space
+            Eigen::Vector3f oc = pl.toObject*o + pl.toObjectOffset;
+            Eigen::Vector3f dc = pl.toObject*d;
+            if (pl.mesh->intersect(oc, dc, tCopy, triangle, u, v)) {
+                hit = {c, triangle, tCopy, u, v};
+                found = true;
+            }
+        });
+        return found;
+    }
+
+    /** @return true, filling 'hit', if some triangle is within
+     *          'maxDistance' of 'p'. */
+    bool closestPoint(const Eigen::Vector3d& p, PointHit& hit,
+                      double maxDistance = std::numeric_limits<double>::infinity()) const {
+        Eigen::Vector3f q = p.cast<float>();
+        float best2 = std::min<double>(maxDistance*maxDistance,
+                                       std::numeric_limits<float>::max());
+        uint32_t triangle;
+        Eigen::Vector3f point;
+        bool found = false;
+        if (layout == FLAT) {
+            auto same = [](const Eigen::Vector3f& x) { return x; };
+            if (!world.closestPoint(q, q, same, 1, best2, triangle, point)) {
+                return false;
+            }
+            locate(triangle, hit.copy, hit.face);
+            found = true;
+        } else {
+            top.closest(q, best2, [&](uint32_t c, float& dBest) {
+                const Placement& pl = placements[c];
+                Eigen::Vector3f qc = pl.toObject*q + pl.toObjectOffset;
+                auto toWorld = [&](const Eigen::Vector3f& x) {
+                    return Eigen::Vector3f(pl.toWorld*x + pl.toWorldOffset);
+                };
+                if (pl.mesh->closestPoint(qc, q, toWorld, pl.minScale2, dBest,
+                                          triangle, point)) {
+                    hit.copy = c;
+                    hit.face = triangle;
+                    found = true;
+                }
+            });
+        }
+        if (found) {
+            hit.distance = std::sqrt(best2);
+            hit.point = point.cast<double>();
+        }
+        return found;
+    }
+
+private:
+    /* Where a copy's Object is in world space, for TWO_LEVEL. */
+    struct Placement {
+        const TriangleBVH* mesh;
+        Eigen::Matrix3f toWorld, toObject;
+        Eigen::Vector3f toWorldOffset, toObjectOffset;
+        float minScale2;  // least squared stretch of 'toWorld'
+    };
+
+    /* Transforms every copy: its triangles into 'world' (FLAT), or its
+       placement and world bounds (TWO_LEVEL). */
+    void placeCopies(const std::vector<Instance>& copies) {
+        ThreadPool& pool = ThreadPool::shared();
+        placements.resize(copies.size());
+        copyBounds.assign(copies.size(), AABB{});
+        firstTriangle.assign(copies.size() + 1, 0);
+        for (size_t c = 0; c < copies.size(); c++) {
+            const Eigen::Matrix4d& m = copies[c].getTransformation();
+            Placement& pl = placements[c];
+            pl.mesh = meshes.at(&copies[c].getObject()).get();
+            pl.toWorld = m.block<3, 3>(0, 0).cast<float>();
+            pl.toWorldOffset = m.block<3, 1>(0, 3).cast<float>();
+            Eigen::Matrix3d inverse = m.block<3, 3>(0, 0).inverse();
+            pl.toObject = inverse.cast<float>();
+            pl.toObjectOffset = (-inverse*m.block<3, 1>(0, 3)).cast<float>();
+            double smallest = Eigen::JacobiSVD<Eigen::Matrix3d>(m.block<3, 3>(0, 0))
+                                  .singularValues().minCoeff();
+            pl.minScale2 = smallest*smallest;
+            firstTriangle[c + 1] = firstTriangle[c] + pl.mesh->numTriangles();
+        }
+
+        if (layout == FLAT) {
+            world.corners.resize(3*firstTriangle.back());
+            pool.parallelFor(copies.size(), 1, [&](size_t lo, size_t hi) {
+                for (size_t c = lo; c < hi; c++) {
+                    const Placement& pl = placements[c];
+                    Eigen::Vector3f* out = &world.corners[3*firstTriangle[c]];
+                    for (const Eigen::Vector3f& x : pl.mesh->corners) {
+                        *out++ = pl.toWorld*x + pl.toWorldOffset;
+                    }
+                }
+            });
+            return;
+        }
+        for (size_t c = 0; c < copies.size(); c++) {
+            const Placement& pl = placements[c];
+            if (pl.mesh->bvh.empty()) {
+                continue;
+            }
+            const AABB& box = pl.mesh->bvh.nodes[0].box;
+            for (int k = 0; k < 8; k++) {
+                Eigen::Vector3f corner((k & 1 ? box.hi : box.lo).x(),
+                                       (k & 2 ? box.hi : box.lo).y(),
+                                       (k & 4 ? box.hi : box.lo).z());
+                copyBounds[c].grow(Eigen::Vector3f(pl.toWorld*corner + pl.toWorldOffset));
+            }
+        }
+    }
+
+    /* Copy and face of a triangle of 'world'. */
+    void locate(uint32_t triangle, size_t& copy, size_t& face) const {
+        copy = std::upper_bound(firstTriangle.begin(), firstTriangle.end(), triangle) -
+               firstTriangle.begin() - 1;
+        face = triangle - firstTriangle[copy];
+    }
+
+    Layout layout{FLAT};
+    std::unordered_map<const Object*, std::shared_ptr<TriangleBVH>> meshes;  // object space
+    std::vector<Placement> placements;  // per copy
+    std::vector<size_t> firstTriangle;  // per copy, into 'world'; one past the end last
+    TriangleBVH world;                  // FLAT
+    std::vector<AABB> copyBounds;       // TWO_LEVEL, world space
+    BVH top;                            // TWO_LEVEL, over 'copyBounds'
+};
+
+/** @brief World-space ray through the center of pixel (x, y) of an
+ *         'xres' x 'yres' image, x to the right and y up. */
+inline void cameraRay(const Camera& camera, double x, double y, size_t xres, size_t yres,
+                      Eigen::Vector3d& origin, Eigen::Vector3d& direction) {
+    Eigen::Matrix4d R;
+    makeRotationMat(R, camera.orientation.x, camera.orientation.y,
+                    camera.orientation.z, camera.orientation.theta);
+    Eigen::Vector3d eye(camera.left + (x + 0.5)/xres*(camera.right - camera.left),
+                        camera.bottom + (y + 0.5)/yres*(camera.top - camera.bottom),
+                        -camera.near);
+    origin = {camera.pos.x, camera.pos.y, camera.pos.z};
+    direction = R.block<3, 3>(0, 0)*eye;
+}
+
+#endif
@@ -0,0 +1,565 @@
+#ifndef CHUNKED_MESH_HPP
+#define CHUNKED_MESH_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Eigen"
+#include "Types.hpp"
+#include "Util.hpp"
+
+/*
+ * Out-of-core meshes. buildChunkedMesh() splits an .obj into spatially
+ * coherent chunks and writes them to a .chunks file:
+ *
+ *     ChunkFileHeader
+ *     ChunkRecord[numChunks]
+ *     per chunk: Vertex vertices[numVertices]
+ *                Vertex normals[numVertices]
+ *                Face faces[numFaces]
+ *
+ * Every chunk is self-contained: vertices on a chunk border are duplicated,
+ * index 0 is a dummy vertex like in Mesh, and face.n == face.v. ChunkedMesh
+ * maps the file read-only and hands out views straight into the mapping;
+ * ChunkCache decides which chunks stay resident.
+ */
+
+struct ChunkFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numChunks;
+};
+
+struct ChunkRecord {
+    Vertex min, max;  // bounds of the chunk's vertices
+    uint64_t offset;  // from start of file
+    uint32_t numVertices;  // including the dummy vertex
+    uint32_t numFaces;
+
+    uint64_t numBytes() const {
+        return 2*numVertices*sizeof(Vertex) + numFaces*sizeof(Face);
+    }
+};
+
+constexpr char CHUNK_FILE_MAGIC[8] = {'G', 'J', 'C', 'C', 'H', 'N', 'K', '\0'};
+constexpr uint32_t CHUNK_FILE_VERSION = 1;
+
+struct ChunkView {
+    const Vertex* vertices;
+    const Vertex* normals;
+    const Face* faces;
+    size_t numVertices;
+    size_t numFaces;
+};
+
+class ChunkedMesh {
+public:
+    /** @brief Maps 'fname', a file written by buildChunkedMesh(). Throws
+     *         std::runtime_error if it cannot be mapped or is malformed. */
+    explicit ChunkedMesh(const std::string& fname) {
+        int fd = ::open(fname.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error("ChunkedMesh: cannot open " + fname);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(ChunkFileHeader)) {
+            ::close(fd);
+            throw std::runtime_error("ChunkedMesh: bad file " + fname);
+        }
+        mappedBytes = st.st_size;
+        void* addr = ::mmap(nullptr, mappedBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            throw std::runtime_error("ChunkedMesh: cannot map " + fname);
+        }
+        base = static_cast<const char*>(addr);
+
+        const ChunkFileHeader* hdr = reinterpret_cast<const ChunkFileHeader*>(base);
+        size_t tableEnd = sizeof(ChunkFileHeader) + hdr->numChunks*sizeof(ChunkRecord);
+        if (std::memcmp(hdr->magic, CHUNK_FILE_MAGIC, sizeof(CHUNK_FILE_MAGIC)) != 0 ||
+            hdr->version != CHUNK_FILE_VERSION || tableEnd > mappedBytes) {
+            ::munmap(addr, mappedBytes);
+            throw std::runtime_error("ChunkedMesh: bad header in " + fname);
+        }
+        records = reinterpret_cast<const ChunkRecord*>(base + sizeof(ChunkFileHeader));
+        numChunks = hdr->numChunks;
+        for (size_t i = 0; i < numChunks; i++) {
+            if (records[i].offset + records[i].numBytes() > mappedBytes) {
+                ::munmap(addr, mappedBytes);
+                throw std::runtime_error("ChunkedMesh: truncated " + fname);
+            }
+        }
+    }
+
+    ~ChunkedMesh();
+
+    ChunkedMesh(const ChunkedMesh&) = delete;
+    ChunkedMesh& operator=(const ChunkedMesh&) = delete;
+
+    size_t size() const {
+        return numChunks;
+    }
+
+    const ChunkRecord& record(size_t i) const {
+        return records[i];
+    }
+
+    /** @brief Pointers into the mapping; pages fault in on first touch. */
+    ChunkView chunk(size_t i) const {
+        const ChunkRecord& r = records[i];
+        const char* p = base + r.offset;
+        ChunkView view;
+        view.vertices = reinterpret_cast<const Vertex*>(p);
+        view.normals = view.vertices + r.numVertices;
+        view.faces = reinterpret_cast<const Face*>(view.normals + r.numVertices);
+        view.numVertices = r.numVertices;
+        view.numFaces = r.numFaces;
+        return view;
+    }
+
+    /** @brief Hints the kernel to read chunk 'i' ahead / drop its pages. */
+    void willNeed(size_t i) const {
+        advise(i, MADV_WILLNEED);
+    }
+
+    void dontNeed(size_t i) const {
+        advise(i, MADV_DONTNEED);
+    }
+
+private:
+    void advise(size_t i, int advice) const {
+        static const uintptr_t page = ::sysconf(_SC_PAGESIZE);
+        uintptr_t begin = reinterpret_cast<uintptr_t>(base + records[i].offset);
+        uintptr_t end = begin + records[i].numBytes();
+        begin &= ~(page - 1);  // madvise wants a page-aligned start
+        ::madvise(reinterpret_cast<void*>(begin), end - begin, advice);
+    }
+
+    const char* base{nullptr};
+    size_t mappedBytes{0};
+    const ChunkRecord* records{nullptr};
+    size_t numChunks{0};
+};
+
+/**
+ * Process-wide LRU over the chunks of every ChunkedMesh. Touching a chunk
+ * makes it most recently used; once the resident chunks exceed the memory
+ * cap, the least recently used ones have their pages dropped. A dropped
+ * chunk stays valid to read, it just faults back in from disk.
+*/
+class ChunkCache {
+public:
+    static ChunkCache& shared() {
+        static ChunkCache cache;
+        return cache;
+    }
+
+    void setMemoryCap(size_t bytes) {
+        std::lock_guard<std::mutex> lock{mtx};
+        memoryCap = bytes;
+        evict();
+    }
+
+    size_t getMemoryCap() {
+        std::lock_guard<std::mutex> lock{mtx};
+        return memoryCap;
+    }
+
+    size_t getResidentBytes() {
+        std::lock_guard<std::mutex> lock{mtx};
+        return residentBytes;
+    }
+
+    ChunkView acquire(const ChunkedMesh& mesh, size_t i) {
+        std::lock_guard<std::mutex> lock{mtx};
+        Key key{&mesh, i};
+        auto it = lookup.find(key);
+        if (it != lookup.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+        } else {
+            mesh.willNeed(i);
+            lru.push_front(key);
+            lookup[key] = lru.begin();
+            residentBytes += mesh.record(i).numBytes();
+            evict(1);  // never evict the chunk being acquired
+        }
+        return mesh.chunk(i);
+    }
+
+    /** @brief Forgets every chunk of 'mesh', e.g. when it is unmapped. */
+    void release(const ChunkedMesh& mesh) {
+        std::lock_guard<std::mutex> lock{mtx};
+        for (auto it = lru.begin(); it != lru.end();) {
+            if (it->mesh == &mesh) {
+                residentBytes -= mesh.record(it->chunk).numBytes();
+                lookup.erase(*it);
+                it = lru.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+private:
+    struct Key {
+        const ChunkedMesh* mesh;
+        size_t chunk;
+
+        bool operator==(const Key& other) const {
+            return mesh == other.mesh && chunk == other.chunk;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            return std::hash<const void*>()(k.mesh) ^ (k.chunk*0x9e3779b97f4a7c15ull);
+        }
+    };
+
+    void evict(size_t keep = 0) {
+        while (residentBytes > memoryCap && lru.size() > keep) {
+            Key victim = lru.back();
+            victim.mesh->dontNeed(victim.chunk);
+            residentBytes -= victim.mesh->record(victim.chunk).numBytes();
+            lookup.erase(victim);
+            lru.pop_back();
+        }
+    }
+
+    std::mutex mtx;
+    size_t memoryCap{size_t(1) << 30};  // 1 GiB
+    size_t residentBytes{0};
+    std::list<Key> lru;
+    std::unordered_map<Key, std::list<Key>::iterator, KeyHash> lookup;
+};
+
+ChunkedMesh::~ChunkedMesh() {
+    ChunkCache::shared().release(*this);
+    ::munmap(const_cast<char*>(base), mappedBytes);
+}
+
+inline bool isChunkedMeshFile(const std::string& fname) {
+    const std::string ext = ".chunks";
+    return fname.size() >= ext.size() &&
+           fname.compare(fname.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+/**
+ * @return false if the axis-aligned box ['lo', 'hi'] lies entirely outside
+ *         one of the six planes of the clip volume of 'worldToHomoNDC'.
+*/
+bool boxInFrustum(const Vertex& lo, const Vertex& hi,
+                  const Eigen::Matrix4d& worldToHomoNDC) {
+    Eigen::Vector4d corners[8];
+    for (int c = 0; c < 8; c++) {
+        Eigen::Vector4d p;
+        p << ((c & 1) ? hi.x : lo.x),
+             ((c & 2) ? hi.y : lo.y),
+             ((c & 4) ? hi.z : lo.z),
+             1;
+        corners[c] = worldToHomoNDC*p;
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        for (int sign = -1; sign <= 1; sign += 2) {
+            bool allOutside = true;
+            for (int c = 0; c < 8 && allOutside; c++) {
+                // inside iff -w <= coord <= w
+                allOutside = sign*corners[c](axis) > corners[c](3);
+            }
+            if (allOutside) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Streams the faces of 'objFname', triangulating polygons as fans, and
+ * calls 'onFace' with each triangle's global (v, n) indices.
+*/
+template <typename F>
+bool forEachOBJFace(const std::string& objFname, F&& onFace) {
+    std::ifstream file{objFname};
+    std::string line;
+    int numVertices = 0, numNormals = 0;
+    while (std::getline(file, line)) {
+        std::string_view rest{line};
+        std::string_view token;
+        if (!next_token(rest, token)) {
+            continue;
+        } else if (token == "v") {
+            numVertices++;
+            continue;
+        } else if (token == "vn") {
+            numNormals++;
+            continue;
+        } else if (token != "f") {
+            continue;
+        }
+        int v[3], n[3];
+        int corner = 0;
+        while (next_token(rest, token)) {
+            int vi, ni;
+            if (!parseFaceCorner(token, numVertices, numNormals, vi, ni)) {
+                return false;
+            }
+            if (corner < 3) {
+                v[corner] = vi;
+                n[corner] = ni;
+                corner++;
+            } else {  // fan: (0, 2, new)
+                v[1] = v[2];
+                n[1] = n[2];
+                v[2] = vi;
+                n[2] = ni;
+            }
+            if (corner == 3) {
+                onFace(Face{{v[0], v[1], v[2]}, {n[0], n[1], n[2]}});
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Writes the .obj 'objFname' to 'chunksFname' as chunks of roughly
+ * 'facesPerChunk' triangles each. Only vertex positions and normals are
+ * held in memory; faces are streamed from the .obj twice and bucketed
+ * through a memory-mapped spill file next to 'chunksFname'. If the .obj
+ * has no normals, area-weighted vertex normals are computed on the way.
+ *
+ * @return false if the .obj is malformed or a file cannot be written.
+*/
+bool buildChunkedMesh(const std::string& objFname,
+                      const std::string& chunksFname,
+                      size_t facesPerChunk = 1 << 16) {
+    std::vector<Vertex> positions(1);  // 1-indexed like the .obj
+    std::vector<Vertex> normals(1);
+    size_t numFaces = 0;
+
+    // Pass 1: positions, normals, triangle count
+    {
+        std::ifstream file{objFname};
+        if (!file) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            std::string_view rest{line};
+            std::string_view hdr;
+            if (!next_token(rest, hdr)) {
+                continue;
+            }
+            double buff[3];
+            if (hdr == "v" || hdr == "vn") {
+                if (parse_numbers(rest, buff, 3) != 3) {
+                    return false;
+                }
+                (hdr == "v" ? positions : normals).push_back({buff[0], buff[1], buff[2]});
+            } else if (hdr == "f") {
+                std::string_view token;
+                int corners = 0;
+                while (next_token(rest, token)) {
+                    corners++;
+                }
+                numFaces += std::max(0, corners - 2);
+            }
+        }
+    }
+    if (numFaces == 0) {
+        return false;
+    }
+    const bool computeNormals = normals.size() == 1;
+    if (computeNormals) {
+        normals.assign(positions.size(), {0, 0, 0});
+    }
+
+    // Cells of a uniform grid over the bounds. Scans are surfaces, so the
+    // number of occupied cells grows like the square of the grid size.
+    Vertex lo{std::numeric_limits<double>::max(),
+              std::numeric_limits<double>::max(),
+              std::numeric_limits<double>::max()};
+    Vertex hi{-lo.x, -lo.y, -lo.z};
+    for (size_t i = 1; i < positions.size(); i++) {
+        lo = {std::min(lo.x, positions[i].x), std::min(lo.y, positions[i].y), std::min(lo.z, positions[i].z)};
+        hi = {std::max(hi.x, positions[i].x), std::max(hi.y, positions[i].y), std::max(hi.z, positions[i].z)};
+    }
+    const size_t grid = std::max<size_t>(1, std::ceil(std::sqrt((double) numFaces / facesPerChunk)));
+    auto cellOf = [&](const Face& f) {
+        const Vertex& a = positions[f.v.i1];
+        const Vertex& b = positions[f.v.i2];
+        const Vertex& c = positions[f.v.i3];
+        double centroid[3] = {(a.x + b.x + c.x)/3, (a.y + b.y + c.y)/3, (a.z + b.z + c.z)/3};
+        double lows[3] = {lo.x, lo.y, lo.z};
+        double extents[3] = {hi.x - lo.x, hi.y - lo.y, hi.z - lo.z};
+        size_t cell = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            size_t k = extents[axis] > 0 ?
+                (size_t) ((centroid[axis] - lows[axis]) / extents[axis] * grid) : 0;
+            cell = cell*grid + std::min(k, grid - 1);
+        }
+        return cell;
+    };
+    auto validFace = [&](const Face& f) {
+        const int* v = &f.v.i1;
+        const int* n = &f.n.i1;
+        for (int k = 0; k < 3; k++) {
+            if (v[k] < 1 || (size_t) v[k] >= positions.size() ||
+                n[k] < 0 || (size_t) n[k] >= normals.size()) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // Pass 2: count faces per cell, accumulate normals if missing
+    std::vector<size_t> cellStart(grid*grid*grid + 1, 0);
+    bool ok = true;
+    bool parsed = forEachOBJFace(objFname, [&](const Face& f) {
+            if (!validFace(f)) {
+                ok = false;
+                return;
+            }
+            cellStart[cellOf(f) + 1]++;
+            if (computeNormals) {
+                const Vertex& a = positions[f.v.i1];
+                const Vertex& b = positions[f.v.i2];
+                const Vertex& c = positions[f.v.i3];
+                Eigen::Vector3d A{b.x - a.x, b.y - a.y, b.z - a.z};
+                Eigen::Vector3d B{c.x - a.x, c.y - a.y, c.z - a.z};
+                // |A x B| is twice the area, so this is area weighted
+                Eigen::Vector3d w = A.cross(B);
+                for (int idx : {f.v.i1, f.v.i2, f.v.i3}) {
+                    normals[idx] = {normals[idx].x + w(0), normals[idx].y + w(1), normals[idx].z + w(2)};
+                }
+            }
+        });
+    if (!parsed || !ok) {
+        return false;
+    }
+    for (size_t c = 1; c < cellStart.size(); c++) {
+        cellStart[c] += cellStart[c - 1];
+    }
+    numFaces = cellStart.back();
+
+    // Pass 3: scatter faces into the spill file, grouped by cell
+    std::string spillFname = chunksFname + ".spill";
+    int spillFd = ::open(spillFname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (spillFd == -1) {
+        return false;
+    }
+    size_t spillBytes = numFaces*sizeof(Face);
+    void* spillAddr = MAP_FAILED;
+    if (::ftruncate(spillFd, spillBytes) == 0) {
+        spillAddr = ::mmap(nullptr, spillBytes, PROT_READ | PROT_WRITE, MAP_SHARED, spillFd, 0);
+    }
+    ::close(spillFd);
+    ::unlink(spillFname.c_str());  // freed once unmapped
+    if (spillAddr == MAP_FAILED) {
+        return false;
+    }
+    Face* spill = static_cast<Face*>(spillAddr);
+    {
+        std::vector<size_t> cursor(cellStart.begin(), cellStart.end() - 1);
+        forEachOBJFace(objFname, [&](const Face& f) {
+            Face g = f;
+            if (computeNormals) {
+                g.n = g.v;
+            }
+            spill[cursor[cellOf(f)]++] = g;
+        });
+    }
+
+    // Write every occupied cell as a chunk with its own vertex numbering
+    std::vector<ChunkRecord> table;
+    for (size_t c = 0; c + 1 < cellStart.size(); c++) {
+        if (cellStart[c + 1] > cellStart[c]) {
+            table.emplace_back();
+        }
+    }
+    std::ofstream out{chunksFname, std::ios::binary};
+    ChunkFileHeader header;
+    std::memcpy(header.magic, CHUNK_FILE_MAGIC, sizeof(CHUNK_FILE_MAGIC));
+    header.version = CHUNK_FILE_VERSION;
+    header.numChunks = table.size();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), table.size()*sizeof(ChunkRecord));
+
+    uint64_t offset = sizeof(header) + table.size()*sizeof(ChunkRecord);
+    size_t chunkIdx = 0;
+    std::unordered_map<uint64_t, int> local;
+    std::vector<Vertex> chunkVertices, chunkNormals;
+    std::vector<Face> chunkFaces;
+    for (size_t c = 0; c + 1 < cellStart.size(); c++) {
+        if (cellStart[c + 1] == cellStart[c]) {
+            continue;
+        }
+        local.clear();
+        chunkVertices.assign(1, Vertex{});
+        chunkNormals.assign(1, Vertex{});
+        chunkFaces.clear();
+        ChunkRecord& r = table[chunkIdx++];
+        r.min = {std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+        r.max = {-r.min.x, -r.min.y, -r.min.z};
+
+        for (size_t i = cellStart[c]; i < cellStart[c + 1]; i++) {
+            const Face& f = spill[i];
+            const int* v = &f.v.i1;
+            const int* n = &f.n.i1;
+            int corners[3];
+            for (int k = 0; k < 3; k++) {
+                uint64_t key = ((uint64_t) v[k] << 32) | (uint32_t) n[k];
+                auto it = local.find(key);
+                if (it == local.end()) {
+                    const Vertex& p = positions[v[k]];
+                    Vertex nrm = normals[n[k]];
+                    if (computeNormals) {
+                        double len = std::sqrt(nrm.x*nrm.x + nrm.y*nrm.y + nrm.z*nrm.z);
+                        if (len > 0) {
+                            nrm = {nrm.x/len, nrm.y/len, nrm.z/len};
+                        }
+                    }
+                    it = local.emplace(key, (int) chunkVertices.size()).first;
+                    chunkVertices.push_back(p);
+                    chunkNormals.push_back(nrm);
+                    r.min = {std::min(r.min.x, p.x), std::min(r.min.y, p.y), std::min(r.min.z, p.z)};
+                    r.max = {std::max(r.max.x, p.x), std::max(r.max.y, p.y), std::max(r.max.z, p.z)};
+                }
+                corners[k] = it->second;
+            }
+            chunkFaces.push_back({{corners[0], corners[1], corners[2]},
+                                  {corners[0], corners[1], corners[2]}});
+        }
+
+        r.offset = offset;
+        r.numVertices = chunkVertices.size();
+        r.numFaces = chunkFaces.size();
+        out.write(reinterpret_cast<const char*>(chunkVertices.data()), chunkVertices.size()*sizeof(Vertex));
+        out.write(reinterpret_cast<const char*>(chunkNormals.data()), chunkNormals.size()*sizeof(Vertex));
+        out.write(reinterpret_cast<const char*>(chunkFaces.data()), chunkFaces.size()*sizeof(Face));
+        offset += r.numBytes();
+    }
+    ::munmap(spillAddr, spillBytes);
+
+    out.seekp(sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), table.size()*sizeof(ChunkRecord));
+    return (bool) out;
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef COMPACT_MESH_HPP
+#define COMPACT_MESH_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Types.hpp"
+#include "Mesh.hpp"
+#include "Meshlets.hpp"
+
+/* Code of the zero vector: -32768 in both halves, which no unit vector
+   encodes to, since coordinates are clamped to [-32767, 32767]. 0 is +Z. */
+const uint32_t OCT_NORMAL_ZERO = 0x80008000u;
+
+/** @brief Packs a unit vector into two snorm16 octahedral coordinates. */
+inline uint32_t encodeOctNormal(const Vertex& n) {
+    double l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (l1 == 0) {
+        return OCT_NORMAL_ZERO;
+    }
+    double u = n.x / l1;
+    double v = n.y / l1;
+    if (n.z < 0) {  // fold the lower hemisphere over the diagonals
+        double fu = (1 - std::abs(v)) * (u >= 0 ? 1 : -1);
+        double fv = (1 - std::abs(u)) * (v >= 0 ? 1 : -1);
+        u = fu;
+        v = fv;
+    }
+    int16_t qu = (int16_t) std::lround(std::clamp(u, -1.0, 1.0) * 32767);
+    int16_t qv = (int16_t) std::lround(std::clamp(v, -1.0, 1.0) * 32767);
+    return ((uint32_t) (uint16_t) qu) | ((uint32_t) (uint16_t) qv << 16);
+}
+
+/** @brief Inverse of encodeOctNormal. Returns a unit vector, or the zero
+ *         vector for OCT_NORMAL_ZERO. */
+inline Vertex decodeOctNormal(uint32_t packed) {
+    if (packed == OCT_NORMAL_ZERO) {
+        return {0, 0, 0};
+    }
+    double u = (int16_t) (packed & 0xffff) / 32767.0;
+    double v = (int16_t) (packed >> 16) / 32767.0;
+    double z = 1 - std::abs(u) - std::abs(v);
+    if (z < 0) {
+        double fu = (1 - std::abs(v)) * (u >= 0 ? 1 : -1);
+        double fv = (1 - std::abs(u)) * (v >= 0 ? 1 : -1);
+        u = fu;
+        v = fv;
+    }
+    double len = std::sqrt(u*u + v*v + z*z);
+    return {u/len, v/len, z/len};
+}
+
+/**
+ * Opt-in compact layout of a Mesh: float positions and 32-bit octahedral
+ * normals in SoA arrays, and one 32-bit index triple per face. Every
+ * distinct (position, encoded normal) pair becomes one vertex, so unlike
+ * Mesh the arrays are 0-indexed and positions and normals share indices.
+*/
+struct CompactMesh {
+    std::vector<float> px, py, pz;
+    std::vector<uint32_t> normals;
+    std::vector<uint32_t> indices;  // 3 per face
+    std::vector<Meshlet> meshlets;  // partition of 'indices'; see buildMeshlets
+
+    size_t numVertices() const {
+        return px.size();
+    }
+
+    size_t numFaces() const {
+        return indices.size() / 3;
+    }
+
+    Vertex position(uint32_t i) const {
+        return {px[i], py[i], pz[i]};
+    }
+
+    Vertex normal(uint32_t i) const {
+        return decodeOctNormal(normals[i]);
+    }
+
+    size_t numBytes() const {
+        return (px.capacity() + py.capacity() + pz.capacity())*sizeof(float) +
+               (normals.capacity() + indices.capacity())*sizeof(uint32_t) +
+               meshlets.capacity()*sizeof(Meshlet);
+    }
+
+    void buildMeshlets() {
+        meshlets = ::buildMeshlets(indices, numVertices(),
+                                   [this](uint32_t i) { return position(i); });
+    }
+};
+
+/** @brief Memory used by the vertex, normal and face arrays of 'mesh'. */
+inline size_t meshBytes(const Mesh& mesh) {
+    return (mesh.vertices.capacity() + mesh.normals.capacity())*sizeof(Vertex) +
+           mesh.faces.capacity()*sizeof(Face);
+}
+
+CompactMesh makeCompactMesh(const Mesh& mesh) {
+    CompactMesh out;
+    std::unordered_map<uint64_t, uint32_t> pairToVertex;
+    pairToVertex.reserve(mesh.vertices.size());
+    out.indices.reserve(3*mesh.faces.size());
+
+    for (const Face& f : mesh.faces) {
+        const int* v = &f.v.i1;
+        const int* n = &f.n.i1;
+        for (int k = 0; k < 3; k++) {
+            // keyed on the encoded normal, so corners whose normals were
+            // computed separately but agree still share a vertex
+            uint32_t packed = encodeOctNormal(mesh.normals[n[k]]);
+            uint64_t key = ((uint64_t) (uint32_t) v[k] << 32) | packed;
+            auto it = pairToVertex.find(key);
+            if (it == pairToVertex.end()) {
+                it = pairToVertex.emplace(key, (uint32_t) out.px.size()).first;
+                const Vertex& p = mesh.vertices[v[k]];
+                out.px.push_back(p.x);
+                out.py.push_back(p.y);
+                out.pz.push_back(p.z);
+                out.normals.push_back(packed);
+            }
+            out.indices.push_back(it->second);
+        }
+    }
+    out.px.shrink_to_fit();
+    out.py.shrink_to_fit();
+    out.pz.shrink_to_fit();
+    out.normals.shrink_to_fit();
+    return out;
+}
+
+/** @brief Expands 'compact' back into the 1-indexed Mesh layout. */
+Mesh expandCompactMesh(const CompactMesh& compact) {
+    Mesh mesh;
+    mesh.vertices.reserve(compact.numVertices() + 1);
+    mesh.normals.reserve(compact.numVertices() + 1);
+    mesh.vertices.emplace_back();  // dummy vertex for 1-indexing
+    mesh.normals.emplace_back();
+    for (uint32_t i = 0; i < compact.numVertices(); i++) {
+        mesh.vertices.push_back(compact.position(i));
+        mesh.normals.push_back(compact.normal(i));
+    }
+    mesh.faces.reserve(compact.numFaces());
+    for (size_t f = 0; f < compact.numFaces(); f++) {
+        int i1 = compact.indices[3*f] + 1;
+        int i2 = compact.indices[3*f + 1] + 1;
+        int i3 = compact.indices[3*f + 2] + 1;
+        mesh.faces.push_back({{i1, i2, i3}, {i1, i2, i3}});
+    }
+    return mesh;
+}
+
+/* Loads through the regular Mesh layout, which is dropped afterwards. */
+void loadOBJ(const std::string& fname, CompactMesh& compact, double weldEpsilon = 0) {
+    Mesh mesh;
+    loadOBJ(fname, mesh, weldEpsilon);
+    compact = makeCompactMesh(mesh);
+    compact.buildMeshlets();
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef CUBE_SHADOW_MAP_HPP
+#define CUBE_SHADOW_MAP_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "Eigen"
+#include "Types.hpp"
+
+/**
+ * Depths seen from a point light in all directions: six square faces of a
+ * cube around it, each the image of a 90 degree frustum looking along +x,
+ * -x, +y, -y, +z or -z. A texel holds the depth along its face's axis of
+ * the nearest surface, infinity where there is none. Filled by
+ * ShadowMapCache, read by LightingModel through PointLight::shadow.
+*/
+class CubeShadowMap {
+public:
+    static const int FACES = 6;
+
+    /** @brief Sizes the map for 'resolution' texels square per face and a
+     *         light at 'light', clearing it; depths lie in [near, far], and
+     *         'bias' is the relative depth difference visibility tolerates. */
+    void reset(const Vertex& light, size_t resolution, double near_, double far_,
+               double bias_) {
+        center = {light.x, light.y, light.z};
+        res = resolution;
+        near = near_;
+        far = far_;
+        bias = bias_;
+        depth.assign(FACES*res*res, std::numeric_limits<float>::infinity());
+    }
+
+    size_t resolution() const {
+        return res;
+    }
+
+    /** @brief Axis 'forward' the face looks along, with 'right' and 'up'
+     *         across it, a right-handed camera frame. */
+    static void faceBasis(int face, Eigen::Vector3d& forward, Eigen::Vector3d& up,
+                          Eigen::Vector3d& right) {
+        forward.setZero();
+        forward(face / 2) = face % 2 ? -1 : 1;
+        up = face / 2 == 1 ? Eigen::Vector3d(0, 0, forward(1)) : Eigen::Vector3d(0, 1, 0);
+        right = forward.cross(up);
+    }
+
+    /** @return World to homogeneous NDC for 'face', for rasterizing it. */
+    Eigen::Matrix4d faceToHomoNDC(int face) const {
+        Eigen::Vector3d forward, up, right;
+        faceBasis(face, forward, up, right);
+        Eigen::Matrix4d view = Eigen::Matrix4d::Identity();
+        view.block<1, 3>(0, 0) = right.transpose();
+        view.block<1, 3>(1, 0) = up.transpose();
+        view.block<1, 3>(2, 0) = -forward.transpose();
+        view.block<3, 1>(0, 3) = -view.block<3, 3>(0, 0)*center;
+
+        // glFrustum with left = bottom = -near and right = top = near
+        Eigen::Matrix4d proj;
+        proj << 1, 0, 0, 0,
+                0, 1, 0, 0,
+                0, 0, -(far + near)/(far - near), -2*far*near/(far - near),
+                0, 0, -1, 0;
+        return proj*view;
+    }
+
+    /** @brief Stores face 'face' from the NDC depths a rasterizer left in
+     *         'minDepth' ([x][y], untouched texels at the double maximum). */
+    void storeFace(int face, const std::vector<std::vector<double>>& minDepth) {
+        float* out = &depth[face*res*res];
+        for (size_t x = 0; x < res; x++) {
+            for (size_t y = 0; y < res; y++) {
+                double z = minDepth[x][y];
+                if (z < std::numeric_limits<double>::max()) {
+                    out[y*res + x] = 2*far*near / ((far + near) - z*(far - near));
+                }
+            }
+        }
+    }
+
+    /**
+     * @return The fraction of the 3 x 3 texels around 'p' that see the
+     *         light, 0 in full shadow. 'p' is moved a texel along the unit
+     *         normal 'n' first, and depths within 'bias' of the stored ones
+     *         count as lit, so surfaces do not shadow themselves.
+    */
+    double visibility(const Eigen::Vector3d& p, const Eigen::Vector3d& n) const {
+        Eigen::Vector3d q = p - center;
+        double texel = 2*q.cwiseAbs().maxCoeff() / res;
+        q += texel*n;
+
+        int axis;
+        double major = q.cwiseAbs().maxCoeff(&axis);
+        if (major <= 0) {
+            return 1;
+        }
+        int face = 2*axis + (q(axis) < 0);
+        Eigen::Vector3d forward, up, right;
+        faceBasis(face, forward, up, right);
+        int tx = (int) ((right.dot(q) / major + 1) / 2 * res);
+        int ty = (int) ((up.dot(q) / major + 1) / 2 * res);
+        const float* in = &depth[face*res*res];
+        double limit = major / (1 + bias);
+        int lit = 0, total = 0;
+        for (int y = std::max(0, ty - 1); y <= std::min<int>(res - 1, ty + 1); y++) {
+            for (int x = std::max(0, tx - 1); x <= std::min<int>(res - 1, tx + 1); x++) {
+                lit += in[y*res + x] >= limit;
+                total++;
+            }
+        }
+        return total > 0 ? (double) lit / total : 1;
+    }
+
+private:
+    Eigen::Vector3d center{0, 0, 0};
+    size_t res{0};
+    double near{0}, far{0};
+    double bias{0};
+    std::vector<float> depth;  // per face, [y*res + x]
+};
+
+#endif
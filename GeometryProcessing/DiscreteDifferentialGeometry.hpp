@@ -4,7 +4,11 @@
 #include "KLiStructs.hpp"
 #include "Halfedge.hpp"
 #include "Types.hpp"
+#include "ThreadPool.hpp"
+#include "HalfedgeMesh.hpp"
+#include <algorithm>
 #include <cmath>
+#include <vector>
 
 KLi::Vec3f calc_normal(KLi::HEF* face) {
   KLi::HE* edge = face->edge;
@@ -60,59 +64,215 @@ KLi::Vec3f calc_vertex_normal(KLi::HEV* vertex)
   return normal;
 }
 
-/* Uses the area-weighted algorithm to populate 'normals' from vertices and faces */
+/* Adds the area-weighted normal of each face in [first, last) to the sums of
+   its three corners, negated for the faces set in 'flipped' if it is given. */
+inline void addFaceNormals(const std::vector<Vertex>& vertices,
+                           const std::vector<Face>& faces,
+                           const std::vector<char>* flipped,
+                           size_t first, size_t last, Vertex* sums) {
+  for (size_t i = first; i < last; i++) {
+    const Face& f = faces[i];
+    const Vertex& a = vertices[f.v.i1];
+    const Vertex& b = vertices[f.v.i2];
+    const Vertex& c = vertices[f.v.i3];
+    KLi::Vec3f A = {(float) (b.x - a.x), (float) (b.y - a.y), (float) (b.z - a.z)};
+    KLi::Vec3f B = {(float) (c.x - a.x), (float) (c.y - a.y), (float) (c.z - a.z)};
+    KLi::Vec3f face_normal = {A.y*B.z - A.z*B.y,
+                              -(A.x*B.z - A.z*B.x),
+                              A.x*B.y - A.y*B.x};
+    double face_area = calc_area(face_normal);
+    if (flipped && (*flipped)[i]) {
+      face_area = -face_area;
+    }
+    for (int idx : {f.v.i1, f.v.i2, f.v.i3}) {
+      sums[idx].x += face_normal.x * face_area;
+      sums[idx].y += face_normal.y * face_area;
+      sums[idx].z += face_normal.z * face_area;
+    }
+  }
+}
+
+/* Uses the area-weighted algorithm to populate 'normals' from vertices and faces,
+   with one normal per vertex, indexed like 'vertices'. The faces are split into
+   one range per worker of ThreadPool::shared(); each range scatter-adds its face
+   normals into its own partial sums, which are then added up vertex by vertex.
+   Faces wound against their neighbours count as reoriented to agree with the
+   first face of their component (HalfedgeMesh::build), as the KLi halfedge did,
+   so inconsistently wound meshes still get coherent normals. Open meshes work
+   too; non-manifold or non-orientable ones are summed as wound. Vertices used
+   by no face get a zero normal. */
 void computeVertexNormals(std::vector<Vertex>& normals,
-                          std::vector<Vertex>& vertices,
-                          std::vector<Face>& faces) {
+                          const std::vector<Vertex>& vertices,
+                          const std::vector<Face>& faces) {
   assert(normals.size() == 1);  // should only contain dummy normal
+  const size_t GRAIN = 1 << 16;
+  ThreadPool& pool = ThreadPool::shared();
 
-  // Put 'vertices', 'faces' into Mesh_Data
-  KLi::Mesh_Data* mesh_data = new KLi::Mesh_Data;
-  mesh_data->vertices = new std::vector<KLi::Vertex*>();
-  mesh_data->faces = new std::vector<KLi::Face*>();
-  for (int i = 0; i < vertices.size(); i++) {
-    KLi::Vertex* v = new KLi::Vertex{(float) vertices[i].x,
-                                     (float) vertices[i].y,
-                                     (float) vertices[i].z};
-    mesh_data->vertices->push_back(v);
-  }
-  for (int i = 0; i < faces.size(); i++) {
-    KLi::Face* f = new KLi::Face{faces[i].v.i1,
-                                 faces[i].v.i2,
-                                 faces[i].v.i3};
-    mesh_data->faces->push_back(f);
+  size_t numParts = std::min(pool.size(), (faces.size() + GRAIN - 1) / GRAIN);
+  numParts = std::max<size_t>(1, numParts);
+  size_t partFaces = (faces.size() + numParts - 1) / numParts;
+
+  std::vector<char> flipped;
+  HalfedgeMesh he;
+  if (he.build(vertices.size(), faces) && he.getReport().flippedFaces > 0) {
+    flipped.resize(faces.size());
+    for (size_t f = 0; f < faces.size(); f++) {
+      flipped[f] = he.vertex[3*f + 1] != faces[f].v.i2;
+    }
   }
 
-  // Populate halfedge data structures
-  std::vector<KLi::HEV*> *hevs = new std::vector<KLi::HEV*>();
-  std::vector<KLi::HEF*> *hefs = new std::vector<KLi::HEF*>();
-  KLi::build_HE(mesh_data, hevs, hefs);
-
-  // Compute normals
-  for (int i = 0; i < hefs->size(); i++) {  // for each face
-    KLi::HE* he = hefs->at(i)->edge;
-    int vertex_count = 0;
-    do {
-      KLi::Vec3f vn = calc_vertex_normal(he->vertex);
-      normals.push_back({vn.x, vn.y, vn.z});
-      vertex_count++;
-      he = he->next;
-    } while (he != hefs->at(i)->edge);
-    assert(vertex_count == 3);
+  // Part 0 sums straight into 'normals'
+  normals.assign(vertices.size(), {0, 0, 0});
+  std::vector<std::vector<Vertex>> partials(numParts - 1);
+  pool.parallelFor(numParts, 1, [&](size_t lo, size_t hi) {
+    for (size_t p = lo; p < hi; p++) {
+      Vertex* sums = normals.data();
+      if (p > 0) {
+        partials[p - 1].assign(vertices.size(), {0, 0, 0});
+        sums = partials[p - 1].data();
+      }
+      size_t first = std::min(faces.size(), p*partFaces);
+      size_t last = std::min(faces.size(), first + partFaces);
+      addFaceNormals(vertices, faces, flipped.empty() ? nullptr : &flipped,
+                     first, last, sums);
+    }
+  });
+  if (partials.empty()) {
+    return;
   }
+  pool.parallelFor(vertices.size(), GRAIN, [&](size_t lo, size_t hi) {
+    for (const std::vector<Vertex>& partial : partials) {
+      for (size_t i = lo; i < hi; i++) {
+        normals[i].x += partial[i].x;
+        normals[i].y += partial[i].y;
+        normals[i].z += partial[i].z;
+      }
+    }
+  });
+}
+
+/* Angle, and its cotangent, at every corner of a HalfedgeMesh, indexed by
+   the halfedge leaving that corner (so corner h sits at he.vertex[h]), plus
+   the area of each face. Computed once and shared by the operators below
+   and by anything else that needs cotangent weights. */
+struct CornerGeometry {
+  std::vector<double> angle;
+  std::vector<double> cotangent;
+  std::vector<double> faceArea;
 
-  // delete allocated memory
-  KLi::delete_HE(hevs, hefs);
-  for (int i = 0; i < mesh_data->vertices->size(); i++) {
-      delete mesh_data->vertices->at(i);
+  /* Cotangent weight of the edge under 'h', (cot a + cot b) / 2 over the
+     corners opposite it; boundary edges have only one. */
+  double cotanWeight(const HalfedgeMesh& he, int32_t h) const {
+    double w = cotangent[he.prev(h)];
+    if (!he.isBoundary(h)) {
+      w += cotangent[he.prev(he.twin[h])];
+    }
+    return 0.5*w;
   }
-  delete mesh_data->vertices;
+};
 
-  for (int i = 0; i < mesh_data->faces->size(); i++) {
-      delete mesh_data->faces->at(i);
+void computeCornerGeometry(const HalfedgeMesh& he, const std::vector<Vertex>& vertices,
+                           CornerGeometry& corners) {
+  const size_t GRAIN = 1 << 14;
+  const size_t numFaces = he.numFaces();
+  corners.angle.resize(3*numFaces);
+  corners.cotangent.resize(3*numFaces);
+  corners.faceArea.resize(numFaces);
+  ThreadPool::shared().parallelFor(numFaces, GRAIN, [&](size_t lo, size_t hi) {
+    for (size_t f = lo; f < hi; f++) {
+      double twiceArea = 0;
+      for (int k = 0; k < 3; k++) {
+        const Vertex& p = vertices[he.vertex[3*f + k]];
+        const Vertex& a = vertices[he.vertex[3*f + (k + 1) % 3]];
+        const Vertex& b = vertices[he.vertex[3*f + (k + 2) % 3]];
+        double ux = a.x - p.x, uy = a.y - p.y, uz = a.z - p.z;
+        double vx = b.x - p.x, vy = b.y - p.y, vz = b.z - p.z;
+        double cx = uy*vz - uz*vy, cy = uz*vx - ux*vz, cz = ux*vy - uy*vx;
+        double cross = std::sqrt(cx*cx + cy*cy + cz*cz);
+        double dot = ux*vx + uy*vy + uz*vz;
+        corners.angle[3*f + k] = std::atan2(cross, dot);
+        corners.cotangent[3*f + k] = cross > 0 ? dot / cross : 0;
+        twiceArea = cross;
+      }
+      corners.faceArea[f] = 0.5*twiceArea;
+    }
+  });
+}
+
+/* Per-vertex results of computeCurvature(), one array per quantity. */
+struct VertexCurvature {
+  std::vector<double> area;               // mixed Voronoi area
+  std::vector<double> meanCurvature;      // H, positive where convex
+  std::vector<double> gaussianCurvature;  // K
+};
+
+/* Mixed Voronoi areas and the mean and Gaussian curvature of Meyer et al.,
+   "Discrete Differential-Geometry Operators for Triangulated 2-Manifolds".
+   One gather over each vertex's one-ring, in parallel over vertices, reading
+   the shared corner data instead of recomputing angles. Boundary vertices
+   measure their angle defect from pi; vertices in no face get zeros. */
+void computeCurvature(const HalfedgeMesh& he, const std::vector<Vertex>& vertices,
+                      const CornerGeometry& corners, VertexCurvature& out) {
+  const size_t GRAIN = 1 << 14;
+  const size_t n = vertices.size();
+  out.area.assign(n, 0);
+  out.meanCurvature.assign(n, 0);
+  out.gaussianCurvature.assign(n, 0);
+  ThreadPool::shared().parallelFor(n, GRAIN, [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; i++) {
+      const Vertex& p = vertices[i];
+      double area = 0, angleSum = 0;
+      double kx = 0, ky = 0, kz = 0;  // mean curvature normal times 2 area
+      double nx = 0, ny = 0, nz = 0;
+      he.forEachOutgoing(i, [&](int32_t h) {
+        int32_t hn = he.next[h], hp = he.prev(h);
+        const Vertex& a = vertices[he.vertex[hn]];
+        const Vertex& b = vertices[he.vertex[hp]];
+        double ax = p.x - a.x, ay = p.y - a.y, az = p.z - a.z;
+        double bx = p.x - b.x, by = p.y - b.y, bz = p.z - b.z;
+        // the edge to a is across from corner hp, the edge to b from hn
+        double cotA = corners.cotangent[hp], cotB = corners.cotangent[hn];
+        kx += cotA*ax + cotB*bx;
+        ky += cotA*ay + cotB*by;
+        kz += cotA*az + cotB*bz;
+        nx += ay*bz - az*by;
+        ny += az*bx - ax*bz;
+        nz += ax*by - ay*bx;
+        angleSum += corners.angle[h];
+
+        double faceArea = corners.faceArea[he.face[h]];
+        if (corners.angle[h] > M_PI/2) {
+          area += faceArea/2;
+        } else if (corners.angle[hn] > M_PI/2 || corners.angle[hp] > M_PI/2) {
+          area += faceArea/4;
+        } else {
+          area += ((ax*ax + ay*ay + az*az)*cotA + (bx*bx + by*by + bz*bz)*cotB) / 8;
+        }
+      });
+      if (area <= 0) {
+        continue;
+      }
+      double meanNormal = std::sqrt(kx*kx + ky*ky + kz*kz) / (4*area);
+      bool convex = kx*nx + ky*ny + kz*nz > 0;  // points out, as on a sphere
+      double fullAngle = he.isBoundaryVertex(i) ? M_PI : 2*M_PI;
+      out.area[i] = area;
+      out.meanCurvature[i] = convex ? meanNormal : -meanNormal;
+      out.gaussianCurvature[i] = (fullAngle - angleSum) / area;
+    }
+  });
+}
+
+/* Builds the connectivity and corner data and runs computeCurvature().
+   Returns false if the mesh is not an orientable manifold. */
+bool computeCurvature(const std::vector<Vertex>& vertices, const std::vector<Face>& faces,
+                      VertexCurvature& out) {
+  HalfedgeMesh he;
+  if (!he.build(vertices.size(), faces)) {
+    return false;
   }
-  delete mesh_data->faces;
-  delete mesh_data;
+  CornerGeometry corners;
+  computeCornerGeometry(he, vertices, corners);
+  computeCurvature(he, vertices, corners, out);
+  return true;
 }
 #endif
-
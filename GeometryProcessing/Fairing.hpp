@@ -0,0 +1,181 @@
+#ifndef FAIRING_HPP
+#define FAIRING_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include "Eigen"
+#include "Types.hpp"
+#include "ThreadPool.hpp"
+
+using SparseMatrixd = Eigen::SparseMatrix<double>;
+
+/**
+ * Assembles the cotangent Laplacian 'L' and the lumped (barycentric) mass
+ * matrix 'M' of a triangle mesh, both 'vertices.size()' square. L(i, j) is
+ * half the sum of the cotangents opposite edge ij and each row sums to 0,
+ * so L is negative semidefinite; M(i, i) is a third of the area of the
+ * faces around i. Vertices used by no face, such as the .obj dummy, get a
+ * zero row in L and unit mass, which keeps M - t*L nonsingular.
+ *
+ * Each face writes its own slots of one triplet array, so faces are
+ * assembled in parallel on ThreadPool::shared() with no locking; Eigen then
+ * sums the duplicates.
+*/
+void assembleLaplacian(const std::vector<Vertex>& vertices,
+                       const std::vector<Face>& faces,
+                       SparseMatrixd& L, SparseMatrixd& M) {
+    using Triplet = Eigen::Triplet<double>;
+    const size_t GRAIN = 1 << 14;
+    const size_t n = vertices.size();
+
+    // 4 entries per edge for L, 1 per corner for M
+    std::vector<Triplet> laplacian(12*faces.size());
+    std::vector<Triplet> mass(3*faces.size());
+    ThreadPool::shared().parallelFor(faces.size(), GRAIN, [&](size_t lo, size_t hi) {
+        for (size_t f = lo; f < hi; f++) {
+            const int v[3] = {faces[f].v.i1, faces[f].v.i2, faces[f].v.i3};
+            Eigen::Vector3d p[3];
+            for (int k = 0; k < 3; k++) {
+                const Vertex& q = vertices[v[k]];
+                p[k] = {q.x, q.y, q.z};
+            }
+            double twiceArea = (p[1] - p[0]).cross(p[2] - p[0]).norm();
+            Triplet* out = &laplacian[12*f];
+            for (int k = 0; k < 3; k++) {
+                // corner k faces the edge between the other two
+                int i = v[(k + 1) % 3], j = v[(k + 2) % 3];
+                double w = 0;
+                if (twiceArea > 0) {
+                    Eigen::Vector3d a = p[(k + 1) % 3] - p[k];
+                    Eigen::Vector3d b = p[(k + 2) % 3] - p[k];
+                    w = 0.5*a.dot(b) / twiceArea;
+                }
+                *out++ = {i, j, w};
+                *out++ = {j, i, w};
+                *out++ = {i, i, -w};
+                *out++ = {j, j, -w};
+                mass[3*f + k] = {v[k], v[k], twiceArea/6};
+            }
+        }
+    });
+
+    std::vector<char> used(n, false);
+    for (const Face& f : faces) {
+        used[f.v.i1] = used[f.v.i2] = used[f.v.i3] = true;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (!used[i]) {
+            mass.push_back({(int) i, (int) i, 1.0});
+        }
+    }
+
+    L.resize(n, n);
+    L.setFromTriplets(laplacian.begin(), laplacian.end());
+    M.resize(n, n);
+    M.setFromTriplets(mass.begin(), mass.end());
+}
+
+/**
+ * Implicit fairing (Desbrun et al., "Implicit Fairing of Irregular Meshes
+ * using Diffusion and Curvature Flow"): each step solves the backward Euler
+ * system (M - dt*L) x' = M x for the new positions, which is stable for any
+ * time step. L and M are those of the mesh passed to the constructor, so the
+ * system matrix depends only on 'dt': its sparse Cholesky factorization is
+ * kept, and further steps with the same 'dt' cost one back-substitution. The
+ * sparsity pattern is analyzed once, so a new 'dt' only refactors.
+ *
+ * 'dt' is in units of area; a step of about the squared mean edge length
+ * smooths away features about one edge across. Call relinearize() to
+ * rebuild L and M from the smoothed positions (curvature flow rather than
+ * diffusion over the original surface).
+*/
+class ImplicitFairing {
+public:
+    ImplicitFairing(const std::vector<Vertex>& vertices, const std::vector<Face>& faces)
+        : faces{faces}
+    {
+        assembleLaplacian(vertices, faces, L, M);
+    }
+
+    /** @brief Rebuilds L and M from 'vertices', dropping the factorization. */
+    void relinearize(const std::vector<Vertex>& vertices) {
+        assembleLaplacian(vertices, faces, L, M);
+        factoredDt = 0;
+    }
+
+    /**
+     * Moves 'vertices' by one backward Euler step of 'dt'.
+     * @return false, leaving 'vertices' alone, if the system could not be
+     *         factored or solved.
+    */
+    bool step(std::vector<Vertex>& vertices, double dt) {
+        return smooth(vertices, dt, 1);
+    }
+
+    /** @brief Takes 'steps' steps of 'dt', factoring at most once. */
+    bool smooth(std::vector<Vertex>& vertices, double dt, size_t steps) {
+        assert(vertices.size() == (size_t) L.rows());
+        if (!factor(dt)) {
+            return false;
+        }
+        const size_t n = vertices.size();
+        Eigen::MatrixXd x(n, 3);
+        for (size_t i = 0; i < n; i++) {
+            x.row(i) << vertices[i].x, vertices[i].y, vertices[i].z;
+        }
+        for (size_t s = 0; s < steps; s++) {
+            Eigen::MatrixXd rhs = M*x;
+            x = solver.solve(rhs);
+            if (solver.info() != Eigen::Success) {
+                std::cerr << "ImplicitFairing: back-substitution failed" << std::endl;
+                return false;
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            vertices[i] = {x(i, 0), x(i, 1), x(i, 2)};
+        }
+        return true;
+    }
+
+    const SparseMatrixd& laplacian() const {
+        return L;
+    }
+
+    const SparseMatrixd& mass() const {
+        return M;
+    }
+
+private:
+    bool factor(double dt) {
+        assert(dt > 0);
+        if (dt == factoredDt) {
+            return true;
+        }
+        SparseMatrixd A = M - dt*L;
+        if (!analyzed) {
+            solver.analyzePattern(A);  // same pattern for every dt
+            analyzed = true;
+        }
+        solver.factorize(A);
+        if (solver.info() != Eigen::Success) {
+            std::cerr << "ImplicitFairing: factorization failed for dt = " << dt
+                      << std::endl;
+            factoredDt = 0;
+            return false;
+        }
+        factoredDt = dt;
+        return true;
+    }
+
+    std::vector<Face> faces;
+    SparseMatrixd L;
+    SparseMatrixd M;
+    Eigen::SimplicialLDLT<SparseMatrixd> solver;
+    bool analyzed{false};
+    double factoredDt{0};  // 0 when nothing is factored
+};
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef GEODESICS_HPP
+#define GEODESICS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+#include "Eigen"
+#include "Types.hpp"
+#include "ThreadPool.hpp"
+#include "HalfedgeMesh.hpp"
+#include "DiscreteDifferentialGeometry.hpp"
+#include "Fairing.hpp"
+
+/**
+ * Geodesic distance with the heat method (Crane, Weischedel and Wardetzky,
+ * "Geodesics in Heat"): diffuse heat from the sources for a short time t,
+ * normalize its negative gradient per face, and recover the distance whose
+ * gradient best matches that field with a Poisson solve. Both systems,
+ * M - t*L for the heat step and -L (regularized) for the Poisson step,
+ * depend only on the mesh, so they are factored once in the constructor and
+ * every query costs two back-substitutions, a gradient pass over the faces
+ * and a divergence pass over the vertices.
+ *
+ * The divergence is gathered around each vertex's one-ring of a
+ * HalfedgeMesh, so vertices are processed in parallel on
+ * ThreadPool::shared() without contention. Boundaries get the Neumann
+ * condition of the assembled Laplacian.
+*/
+class HeatGeodesics {
+public:
+    /**
+     * @param timeScale  t is 'timeScale' times the squared mean edge length;
+     *                   larger values give smoother, less accurate distances.
+    */
+    HeatGeodesics(const std::vector<Vertex>& vertices, const std::vector<Face>& faces,
+                  double timeScale = 1.0)
+        : positions{vertices}
+    {
+        if (!he.build(vertices.size(), faces)) {
+            std::cerr << "HeatGeodesics: mesh is not an orientable manifold" << std::endl;
+            return;
+        }
+        const size_t numHalfedges = he.vertex.size();
+
+        // Corner cotangents, shared with the divergence pass, and mean edge
+        // length
+        computeCornerGeometry(he, vertices, corners);
+        double lengthSum = 0;
+        for (size_t h = 0; h < numHalfedges; h++) {
+            const Vertex& p = vertices[he.vertex[h]];
+            const Vertex& q = vertices[he.tip(h)];
+            double dx = q.x - p.x, dy = q.y - p.y, dz = q.z - p.z;
+            lengthSum += std::sqrt(dx*dx + dy*dy + dz*dz);
+        }
+        double meanLength = numHalfedges > 0 ? lengthSum / numHalfedges : 0;
+        t = timeScale*meanLength*meanLength;
+
+        SparseMatrixd L, M;
+        assembleLaplacian(vertices, faces, L, M);
+        heat.compute(M - t*L);
+        // -L is singular along constants; a tiny multiple of M fixes that
+        // without visibly changing distances, which are shifted afterwards
+        poisson.compute(-L + 1e-8*M);
+        valid = heat.info() == Eigen::Success && poisson.info() == Eigen::Success;
+        if (!valid) {
+            std::cerr << "HeatGeodesics: factorization failed" << std::endl;
+        }
+    }
+
+    bool isValid() const {
+        return valid;
+    }
+
+    /**
+     * Fills 'distance', indexed like the vertices, with the geodesic
+     * distance to the nearest of 'sources'. Vertices used by no face, and
+     * components without a source, are left approximate.
+     * @return false if the mesh was rejected or the solves failed.
+    */
+    bool compute(const std::vector<int>& sources, std::vector<double>& distance) const {
+        if (!valid || sources.empty()) {
+            return false;
+        }
+        const size_t GRAIN = 1 << 14;
+        const size_t n = positions.size();
+        const size_t numFaces = he.numFaces();
+        ThreadPool& pool = ThreadPool::shared();
+
+        Eigen::VectorXd delta = Eigen::VectorXd::Zero(n);
+        for (int s : sources) {
+            delta(s) = 1;
+        }
+        Eigen::VectorXd u = heat.solve(delta);
+
+        // Unit field against the heat gradient, per face
+        std::vector<Eigen::Vector3d> field(numFaces);
+        pool.parallelFor(numFaces, GRAIN, [&](size_t lo, size_t hi) {
+            for (size_t f = lo; f < hi; f++) {
+                const int32_t* v = &he.vertex[3*f];
+                Eigen::Vector3d normal = (at(v[1]) - at(v[0])).cross(at(v[2]) - at(v[0]));
+                Eigen::Vector3d gradient = Eigen::Vector3d::Zero();
+                for (int k = 0; k < 3; k++) {
+                    // edge opposite corner k, counterclockwise
+                    Eigen::Vector3d e = at(v[(k + 2) % 3]) - at(v[(k + 1) % 3]);
+                    gradient += u(v[k])*normal.cross(e);
+                }
+                double length = gradient.norm();
+                field[f] = length > 0 ? Eigen::Vector3d(-gradient / length)
+                                      : Eigen::Vector3d::Zero();
+            }
+        });
+
+        // Integrated divergence, gathered over each one-ring
+        Eigen::VectorXd divergence(n);
+        pool.parallelFor(n, GRAIN, [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i++) {
+                double sum = 0;
+                he.forEachOutgoing(i, [&](int32_t h) {
+                    int32_t hn = he.next[h], hp = he.prev(h);
+                    const Eigen::Vector3d& X = field[he.face[h]];
+                    sum += corners.cotangent[hp]*(at(he.vertex[hn]) - at(i)).dot(X) +
+                           corners.cotangent[hn]*(at(he.vertex[hp]) - at(i)).dot(X);
+                });
+                divergence(i) = 0.5*sum;
+            }
+        });
+
+        Eigen::VectorXd phi = poisson.solve(-divergence);
+        if (heat.info() != Eigen::Success || poisson.info() != Eigen::Success) {
+            std::cerr << "HeatGeodesics: back-substitution failed" << std::endl;
+            return false;
+        }
+        double base = std::numeric_limits<double>::max();
+        for (int s : sources) {
+            base = std::min(base, phi(s));
+        }
+        distance.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            distance[i] = std::max(0.0, phi(i) - base);
+        }
+        return true;
+    }
+
+    const HalfedgeMesh& connectivity() const {
+        return he;
+    }
+
+private:
+    Eigen::Vector3d at(int32_t v) const {
+        const Vertex& p = positions[v];
+        return {p.x, p.y, p.z};
+    }
+
+    std::vector<Vertex> positions;
+    HalfedgeMesh he;
+    CornerGeometry corners;
+    double t{0};
+    Eigen::SimplicialLDLT<SparseMatrixd> heat;
+    Eigen::SimplicialLDLT<SparseMatrixd> poisson;
+    bool valid{false};
+};
+
+/**
+ * Shortest distances along the edges of 'he' from the nearest of
+ * 'sources', by Dijkstra's algorithm. Overestimates true geodesic distance
+ * (by up to about 8% on regular meshes, more on irregular ones); the
+ * baseline that HeatGeodesics is measured against. Unreachable vertices get
+ * infinity.
+*/
+void edgeDistances(const HalfedgeMesh& he, const std::vector<Vertex>& vertices,
+                   const std::vector<int>& sources, std::vector<double>& distance) {
+    using Entry = std::pair<double, int32_t>;
+    distance.assign(vertices.size(), std::numeric_limits<double>::infinity());
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+    for (int s : sources) {
+        distance[s] = 0;
+        queue.push({0.0, s});
+    }
+    while (!queue.empty()) {
+        auto [d, v] = queue.top();
+        queue.pop();
+        if (d > distance[v]) {
+            continue;  // stale
+        }
+        const Vertex& p = vertices[v];
+        he.forEachNeighbor(v, [&](int32_t w) {
+            const Vertex& q = vertices[w];
+            double dx = q.x - p.x, dy = q.y - p.y, dz = q.z - p.z;
+            double dw = d + std::sqrt(dx*dx + dy*dy + dz*dz);
+            if (dw < distance[w]) {
+                distance[w] = dw;
+                queue.push({dw, w});
+            }
+        });
+    }
+}
+
+#endif
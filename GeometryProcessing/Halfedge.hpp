@@ -178,11 +178,11 @@ static bool check_face(HEF *face);
 static bool orient_flip_face(HE *edge);
 static bool orient_face(HEF *face);
 
-static bool build_HE(Mesh_Data *mesh,
-                     std::vector<HEV*> *hevs,
-                     std::vector<HEF*> *hefs);
+static inline bool build_HE(Mesh_Data *mesh,
+                            std::vector<HEV*> *hevs,
+                            std::vector<HEF*> *hefs);
 
-static void delete_HE(std::vector<HEV*> *hevs, std::vector<HEF*> *hefs);
+static inline void delete_HE(std::vector<HEV*> *hevs, std::vector<HEF*> *hefs);
 
 /* Function implementations */
 
@@ -290,9 +290,9 @@ static bool orient_face(HEF *face)
            && check_face(face);
 }
 
-static bool build_HE(Mesh_Data *mesh,
-                     std::vector<HEV*> *hevs,
-                     std::vector<HEF*> *hefs)
+static inline bool build_HE(Mesh_Data *mesh,
+                            std::vector<HEV*> *hevs,
+                            std::vector<HEF*> *hefs)
 {
     std::vector<Vertex*> *vertices = mesh->vertices;
     std::vector<Face*> *faces = mesh->faces;
@@ -365,7 +365,7 @@ static bool build_HE(Mesh_Data *mesh,
     return orient_face(first_face);
 }
 
-static void delete_HE(std::vector<HEV*> *hevs, std::vector<HEF*> *hefs)
+static inline void delete_HE(std::vector<HEV*> *hevs, std::vector<HEF*> *hefs)
 {
     int hev_size = hevs->size();
     int num_hefs = hefs->size();
@@ -0,0 +1,253 @@
+#ifndef HALFEDGE_MESH_HPP
+#define HALFEDGE_MESH_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "Types.hpp"
+
+/**
+ * Halfedge structure of a triangle mesh stored as flat int32 arrays, one
+ * entry per halfedge: 'next', 'twin', 'vertex' (where it starts) and
+ * 'face'. Face f owns halfedges 3f, 3f + 1 and 3f + 2. Vertex indices are
+ * those of the faces it was built from, so with .obj faces vertex 0 is the
+ * unused dummy.
+ *
+ * Unlike KLi::build_HE, meshes may have boundaries: a halfedge with no
+ * opposite face has twin INVALID. Twins are paired by bucketing halfedges
+ * on their lower vertex, and faces are oriented consistently by an
+ * iterative breadth-first search, so the build is linear in the size of
+ * the mesh and uses no recursion.
+*/
+class HalfedgeMesh {
+public:
+    static constexpr int32_t INVALID = -1;
+
+    std::vector<int32_t> next;
+    std::vector<int32_t> twin;
+    std::vector<int32_t> vertex;
+    std::vector<int32_t> face;
+    std::vector<int32_t> out;  // per vertex; a boundary halfedge if it has one
+
+    /** Problems that make build() fail. */
+    struct BuildReport {
+        size_t nonManifoldEdges{0};  // used by more than two faces
+        size_t flippedFaces{0};      // reoriented to match their neighbours
+        bool orientable{true};
+    };
+
+    /**
+     * Builds the structure for 'faces' (position indices, below
+     * 'numVertices'), reorienting faces where needed to agree with the
+     * first face of their connected component.
+     * @return false if the mesh has non-manifold edges or is not
+     *         orientable; see getReport().
+    */
+    bool build(size_t numVertices, const std::vector<Face>& faces) {
+        const size_t numHalfedges = 3*faces.size();
+        report = BuildReport{};
+        next.resize(numHalfedges);
+        twin.assign(numHalfedges, INVALID);
+        vertex.resize(numHalfedges);
+        face.resize(numHalfedges);
+        for (size_t f = 0; f < faces.size(); f++) {
+            const int* v = &faces[f].v.i1;
+            for (int k = 0; k < 3; k++) {
+                size_t h = 3*f + k;
+                next[h] = 3*f + (k + 1) % 3;
+                vertex[h] = v[k];
+                face[h] = f;
+            }
+        }
+
+        if (!pairTwins(numVertices) || !orient()) {
+            return false;
+        }
+
+        out.assign(numVertices, INVALID);
+        for (size_t h = 0; h < numHalfedges; h++) {
+            int32_t& o = out[vertex[h]];
+            if (o == INVALID || twin[h] == INVALID) {
+                o = h;
+            }
+        }
+        return true;
+    }
+
+    const BuildReport& getReport() const {
+        return report;
+    }
+
+    size_t numFaces() const {
+        return face.size() / 3;
+    }
+
+    int32_t prev(int32_t h) const {
+        return next[next[h]];
+    }
+
+    /** @return Vertex that 'h' points to. */
+    int32_t tip(int32_t h) const {
+        return vertex[next[h]];
+    }
+
+    bool isBoundary(int32_t h) const {
+        return twin[h] == INVALID;
+    }
+
+    /**
+     * Calls 'fn(h)' for each halfedge out of 'v', counterclockwise, so once
+     * per face around it. On a boundary vertex the walk starts at its
+     * boundary halfedge and stops at the other side of the gap.
+    */
+    template <typename F>
+    void forEachOutgoing(int32_t v, F&& fn) const {
+        int32_t first = out[v];
+        if (first == INVALID) {
+            return;
+        }
+        int32_t h = first;
+        do {
+            fn(h);
+            h = twin[prev(h)];
+        } while (h != INVALID && h != first);
+    }
+
+    /** @brief Calls 'fn(w)' for each vertex sharing an edge with 'v'. */
+    template <typename F>
+    void forEachNeighbor(int32_t v, F&& fn) const {
+        int32_t last = INVALID;
+        forEachOutgoing(v, [&](int32_t h) {
+            fn(tip(h));
+            last = h;
+        });
+        if (last != INVALID && isBoundary(prev(last))) {
+            fn(vertex[prev(last)]);  // across the gap
+        }
+    }
+
+    bool isBoundaryVertex(int32_t v) const {
+        return out[v] != INVALID && isBoundary(out[v]);
+    }
+
+private:
+    /* Buckets halfedges by their lower vertex; the halfedges of an edge
+       then share a bucket, which holds only about six entries. */
+    bool pairTwins(size_t numVertices) {
+        const size_t numHalfedges = vertex.size();
+        std::vector<int32_t> bucketStart(numVertices + 1, 0);
+        for (size_t h = 0; h < numHalfedges; h++) {
+            bucketStart[lowVertex(h) + 1]++;
+        }
+        for (size_t v = 0; v < numVertices; v++) {
+            bucketStart[v + 1] += bucketStart[v];
+        }
+        std::vector<int32_t> bucket(numHalfedges);
+        {
+            std::vector<int32_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+            for (size_t h = 0; h < numHalfedges; h++) {
+                bucket[fill[lowVertex(h)]++] = h;
+            }
+        }
+
+        for (size_t v = 0; v < numVertices; v++) {
+            for (int32_t i = bucketStart[v]; i < bucketStart[v + 1]; i++) {
+                int32_t h = bucket[i];
+                if (twin[h] != INVALID) {
+                    continue;
+                }
+                int32_t high = highVertex(h);
+                int32_t uses = 1;
+                for (int32_t j = i + 1; j < bucketStart[v + 1]; j++) {
+                    int32_t g = bucket[j];
+                    if (highVertex(g) != high) {
+                        continue;
+                    }
+                    if (++uses == 2) {
+                        twin[h] = g;
+                        twin[g] = h;
+                    }
+                }
+                if (uses > 2) {
+                    report.nonManifoldEdges++;
+                }
+            }
+        }
+        return report.nonManifoldEdges == 0;
+    }
+
+    int32_t lowVertex(size_t h) const {
+        return std::min(vertex[h], vertex[next[h]]);
+    }
+
+    int32_t highVertex(size_t h) const {
+        return std::max(vertex[h], vertex[next[h]]);
+    }
+
+    /* Breadth-first over faces: a face must run each shared edge the other
+       way from its neighbour, or it is marked flipped. Flipped faces are
+       then reversed in place, swapping their second and third corners. */
+    bool orient() {
+        const size_t faceCount = numFaces();
+        enum : char {UNSEEN, KEEP, FLIP};
+        std::vector<char> state(faceCount, UNSEEN);
+        std::vector<int32_t> queue;
+        queue.reserve(faceCount);
+
+        for (size_t seed = 0; seed < faceCount; seed++) {
+            if (state[seed] != UNSEEN) {
+                continue;
+            }
+            state[seed] = KEEP;
+            queue.clear();
+            queue.push_back(seed);
+            for (size_t q = 0; q < queue.size(); q++) {
+                int32_t f = queue[q];
+                for (int k = 0; k < 3; k++) {
+                    int32_t h = 3*f + k;
+                    int32_t g = twin[h];
+                    if (g == INVALID) {
+                        continue;
+                    }
+                    // same direction means exactly one of the two is flipped
+                    bool sameDirection = vertex[h] == vertex[g];
+                    char needed = (sameDirection == (state[f] == FLIP)) ? KEEP : FLIP;
+                    int32_t neighbour = face[g];
+                    if (state[neighbour] == UNSEEN) {
+                        state[neighbour] = needed;
+                        queue.push_back(neighbour);
+                    } else if (state[neighbour] != needed) {
+                        report.orientable = false;
+                        return false;
+                    }
+                }
+            }
+        }
+
+        // Corners (a, b, c) become (a, c, b), so the halfedges on edges ab,
+        // bc and ca move from slots 0, 1, 2 to slots 2, 1, 0
+        auto moved = [&](int32_t h) {
+            if (h == INVALID || state[h / 3] != FLIP) {
+                return h;
+            }
+            return h - h % 3 + 2 - h % 3;
+        };
+        std::vector<int32_t> newTwin(twin.size());
+        for (size_t h = 0; h < twin.size(); h++) {
+            newTwin[moved(h)] = moved(twin[h]);
+        }
+        twin.swap(newTwin);
+        for (size_t f = 0; f < faceCount; f++) {
+            if (state[f] == FLIP) {
+                std::swap(vertex[3*f + 1], vertex[3*f + 2]);
+                report.flippedFaces++;
+            }
+        }
+        return true;
+    }
+
+    BuildReport report;
+};
+
+#endif
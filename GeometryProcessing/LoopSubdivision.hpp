@@ -0,0 +1,185 @@
+#ifndef LOOP_SUBDIVISION_HPP
+#define LOOP_SUBDIVISION_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "Types.hpp"
+#include "ThreadPool.hpp"
+#include "HalfedgeMesh.hpp"
+
+/**
+ * One step of adaptive Loop subdivision ("Smooth Subdivision Surfaces Based
+ * on Triangles", with Warren's vertex weights) of a mesh in the 1-indexed
+ * .obj layout. Faces with 'refine' set are split in four; so is any face
+ * left with two split edges, until none is, and faces with one split edge
+ * are bisected so that the result has no T-junctions. Every edge that is
+ * split gets a Loop edge point, and every vertex on a split edge moves to
+ * its Loop vertex position; boundaries use the cubic B-spline rules, so
+ * open meshes stay open.
+ *
+ * Faces come out oriented like the first face of their component and with
+ * normal indices equal to position indices; the caller recomputes normals.
+ *
+ * @param parent   out: per output face, the input face it lies in
+ * @param changed  out: per output face, true unless it is an input face
+ *                 whose corners all stayed put
+ * @return false, changing nothing, if the mesh is not an orientable
+ *         manifold
+*/
+bool loopSubdivide(std::vector<Vertex>& vertices, std::vector<Face>& faces,
+                   const std::vector<char>& refine, std::vector<uint32_t>& parent,
+                   std::vector<char>& changed) {
+    const size_t GRAIN = 1 << 14;
+    const int32_t INVALID = HalfedgeMesh::INVALID;
+    HalfedgeMesh he;
+    if (!he.build(vertices.size(), faces)) {
+        return false;
+    }
+    const size_t numFaces = faces.size();
+    const size_t numHalfedges = 3*numFaces;
+    ThreadPool& pool = ThreadPool::shared();
+
+    // Close the set of faces split in four, splitting edges on the way
+    std::vector<char> red(refine.begin(), refine.end());
+    red.resize(numFaces, false);
+    std::vector<char> split(numHalfedges, false);
+    std::vector<int32_t> queue;
+    for (size_t f = 0; f < numFaces; f++) {
+        if (red[f]) {
+            queue.push_back(f);
+        }
+    }
+    auto splitEdges = [&](int32_t f) {
+        return split[3*f] + split[3*f + 1] + split[3*f + 2];
+    };
+    while (!queue.empty()) {
+        int32_t f = queue.back();
+        queue.pop_back();
+        for (int32_t h = 3*f; h < 3*f + 3; h++) {
+            split[h] = true;
+            int32_t g = he.twin[h];
+            if (g == INVALID || split[g]) {
+                continue;
+            }
+            split[g] = true;
+            int32_t neighbour = he.face[g];
+            if (!red[neighbour] && splitEdges(neighbour) >= 2) {
+                red[neighbour] = true;
+                queue.push_back(neighbour);
+            }
+        }
+    }
+
+    // Number the edge points, then place them and the moved vertices from
+    // the old positions
+    const size_t numOld = vertices.size();
+    std::vector<int32_t> edgePoint(numHalfedges, INVALID);
+    size_t numNew = numOld;
+    for (size_t h = 0; h < numHalfedges; h++) {
+        int32_t g = he.twin[h];
+        if (split[h] && (g == INVALID || (int32_t) h < g)) {
+            edgePoint[h] = numNew++;
+            if (g != INVALID) {
+                edgePoint[g] = edgePoint[h];
+            }
+        }
+    }
+    std::vector<char> moved(numOld, false);
+    for (size_t h = 0; h < numHalfedges; h++) {
+        if (split[h]) {
+            moved[he.vertex[h]] = moved[he.tip(h)] = true;
+        }
+    }
+
+    std::vector<Vertex> out(numNew);
+    pool.parallelFor(numHalfedges, GRAIN, [&](size_t lo, size_t hi) {
+        for (size_t h = lo; h < hi; h++) {
+            int32_t g = he.twin[h];
+            if (edgePoint[h] == INVALID || (g != INVALID && g < (int32_t) h)) {
+                continue;  // placed from its twin
+            }
+            const Vertex& a = vertices[he.vertex[h]];
+            const Vertex& b = vertices[he.tip(h)];
+            if (g == INVALID) {
+                out[edgePoint[h]] = {(a.x + b.x)/2, (a.y + b.y)/2, (a.z + b.z)/2};
+                continue;
+            }
+            const Vertex& c = vertices[he.vertex[he.prev(h)]];
+            const Vertex& d = vertices[he.vertex[he.prev(g)]];
+            out[edgePoint[h]] = {3*(a.x + b.x)/8 + (c.x + d.x)/8,
+                                 3*(a.y + b.y)/8 + (c.y + d.y)/8,
+                                 3*(a.z + b.z)/8 + (c.z + d.z)/8};
+        }
+    });
+    pool.parallelFor(numOld, GRAIN, [&](size_t lo, size_t hi) {
+        for (size_t v = lo; v < hi; v++) {
+            const Vertex& p = vertices[v];
+            if (!moved[v]) {
+                out[v] = p;
+                continue;
+            }
+            if (he.isBoundaryVertex(v)) {
+                // the two boundary neighbours: across the boundary halfedge
+                // out of v, and across the one into it
+                int32_t last = he.out[v];
+                he.forEachOutgoing(v, [&](int32_t h) { last = h; });
+                const Vertex& a = vertices[he.tip(he.out[v])];
+                const Vertex& b = vertices[he.vertex[he.prev(last)]];
+                out[v] = {3*p.x/4 + (a.x + b.x)/8, 3*p.y/4 + (a.y + b.y)/8,
+                          3*p.z/4 + (a.z + b.z)/8};
+                continue;
+            }
+            Vertex sum = {0, 0, 0};
+            int n = 0;
+            he.forEachNeighbor(v, [&](int32_t w) {
+                sum.x += vertices[w].x;
+                sum.y += vertices[w].y;
+                sum.z += vertices[w].z;
+                n++;
+            });
+            double beta = n == 3 ? 3.0/16 : 3.0/(8*n);
+            out[v] = {(1 - n*beta)*p.x + beta*sum.x, (1 - n*beta)*p.y + beta*sum.y,
+                      (1 - n*beta)*p.z + beta*sum.z};
+        }
+    });
+
+    // Red faces become four, faces with one split edge two
+    std::vector<Face> outFaces;
+    outFaces.reserve(numFaces + 3*numFaces / 4);
+    parent.clear();
+    changed.clear();
+    auto emit = [&](size_t f, int a, int b, int c, bool isChanged) {
+        outFaces.push_back({{a, b, c}, {a, b, c}});
+        parent.push_back(f);
+        changed.push_back(isChanged);
+    };
+    for (size_t f = 0; f < numFaces; f++) {
+        const int32_t* c = &he.vertex[3*f];
+        const int32_t* m = &edgePoint[3*f];  // m[k] on the edge from c[k]
+        switch (splitEdges(f)) {
+        case 0:
+            emit(f, c[0], c[1], c[2], moved[c[0]] || moved[c[1]] || moved[c[2]]);
+            break;
+        case 1:
+            for (int k = 0; k < 3; k++) {
+                if (split[3*f + k]) {
+                    int next = (k + 1) % 3, opposite = (k + 2) % 3;
+                    emit(f, c[k], m[k], c[opposite], true);
+                    emit(f, m[k], c[next], c[opposite], true);
+                }
+            }
+            break;
+        default:
+            emit(f, c[0], m[0], m[2], true);
+            emit(f, c[1], m[1], m[0], true);
+            emit(f, c[2], m[2], m[1], true);
+            emit(f, m[0], m[1], m[2], true);
+        }
+    }
+    vertices.swap(out);
+    faces.swap(outFaces);
+    return true;
+}
+
+#endif
@@ -0,0 +1,341 @@
+#ifndef MESH_REPAIR_HPP
+#define MESH_REPAIR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include "Types.hpp"
+#include "ThreadPool.hpp"
+
+/** What repairMesh() changed, and what it found but cannot fix. */
+struct MeshRepairReport {
+    size_t weldedVertices{0};     // merged into another vertex
+    size_t unusedVertices{0};     // referenced by no face, dropped
+    size_t degenerateFaces{0};    // repeated or out-of-range vertex, or zero area
+    size_t duplicateFaces{0};     // same vertex set as an earlier face
+    size_t boundaryEdges{0};      // used by one face
+    size_t nonManifoldEdges{0};   // used by more than two faces
+
+    /** @return true if the halfedge structure can be built (KLi::build_HE
+     *          handles closed manifold meshes only). */
+    bool isClosedManifold() const {
+        return boundaryEdges == 0 && nonManifoldEdges == 0;
+    }
+};
+
+namespace MeshRepair {
+
+/* Integer coordinates of a grid cell, or the bit patterns of a position
+   when welding exact duplicates only. */
+struct CellKey {
+    int64_t x, y, z;
+
+    bool operator==(const CellKey& other) const {
+        return x == other.x && y == other.y && z == other.z;
+    }
+};
+
+struct CellKeyHash {
+    size_t operator()(const CellKey& k) const {
+        uint64_t h = (uint64_t) k.x*0x9e3779b97f4a7c15ull;
+        h ^= (uint64_t) k.y*0xc2b2ae3d27d4eb4full + (h << 6) + (h >> 2);
+        h ^= (uint64_t) k.z*0x165667b19e3779f9ull + (h << 6) + (h >> 2);
+        return h;
+    }
+};
+
+/* Cells are this many epsilons wide, so most vertices are further than
+   epsilon from every cell wall and only look in their own cell. */
+const double CELL_EPSILONS = 4;
+
+inline CellKey cellOf(const Vertex& p, double cellSize) {
+    if (cellSize <= 0) {
+        CellKey k;
+        double x = p.x + 0.0, y = p.y + 0.0, z = p.z + 0.0;  // -0 == +0
+        std::memcpy(&k.x, &x, sizeof(double));
+        std::memcpy(&k.y, &y, sizeof(double));
+        std::memcpy(&k.z, &z, sizeof(double));
+        return k;
+    }
+    return {(int64_t) std::floor(p.x / cellSize),
+            (int64_t) std::floor(p.y / cellSize),
+            (int64_t) std::floor(p.z / cellSize)};
+}
+
+/**
+ * Open-addressing hash map with linear probing, for the tens of millions
+ * of small keys repairMesh() hashes; std::unordered_map allocates a node
+ * for each of them.
+*/
+template <typename Key, typename Value, typename Hash>
+class FlatMap {
+public:
+    explicit FlatMap(size_t expected) {
+        size_t capacity = 16;
+        while (capacity < 2*expected) {
+            capacity <<= 1;
+        }
+        slots.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    /** @return The value for 'key', inserting 'value' if it is absent, and
+     *          whether it was inserted. */
+    std::pair<Value*, bool> insert(const Key& key, const Value& value) {
+        size_t i = Hash()(key) & mask;
+        while (slots[i].used) {
+            if (slots[i].key == key) {
+                return {&slots[i].value, false};
+            }
+            i = (i + 1) & mask;
+        }
+        slots[i] = {key, value, true};
+        return {&slots[i].value, true};
+    }
+
+    const Value* find(const Key& key) const {
+        size_t i = Hash()(key) & mask;
+        while (slots[i].used) {
+            if (slots[i].key == key) {
+                return &slots[i].value;
+            }
+            i = (i + 1) & mask;
+        }
+        return nullptr;
+    }
+
+    template <typename F>
+    void forEach(F&& fn) const {
+        for (const Slot& slot : slots) {
+            if (slot.used) {
+                fn(slot.key, slot.value);
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        Key key;
+        Value value;
+        bool used;
+    };
+
+    std::vector<Slot> slots;
+    size_t mask;
+};
+
+struct EdgeKeyHash {
+    size_t operator()(uint64_t k) const {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        return k;
+    }
+};
+
+inline uint64_t edgeKey(int a, int b) {
+    return ((uint64_t) (uint32_t) std::min(a, b) << 32) | (uint32_t) std::max(a, b);
+}
+
+struct FaceKey {
+    int a, b, c;  // rotated to start at the lowest, keeping the orientation
+
+    bool operator==(const FaceKey& other) const {
+        return a == other.a && b == other.b && c == other.c;
+    }
+};
+
+struct FaceKeyHash {
+    size_t operator()(const FaceKey& k) const {
+        return CellKeyHash()({k.a, k.b, k.c});
+    }
+};
+
+const size_t GRAIN = 1 << 16;
+
+}  // namespace MeshRepair
+
+/**
+ * Cleans up 'vertices' and the position indices of 'faces' (1-indexed, as
+ * loaded from an .obj) so that the halfedge structure can be built:
+ *
+ *  - welds vertices closer than 'weldEpsilon' along every axis, found with
+ *    a hash grid (exact duplicates only when it is 0),
+ *  - drops faces with repeated vertices or zero area, then faces over the
+ *    same three vertices as an earlier face in the same orientation (an
+ *    opposite pair is kept: it is the two sides of a sheet),
+ *  - drops vertices no face uses, and
+ *  - counts boundary and non-manifold edges, which it cannot fix.
+ *
+ * Normal indices are left alone. Every step is linear in the size of the
+ * mesh; the per-vertex and per-face ones run on ThreadPool::shared().
+*/
+MeshRepairReport repairMesh(std::vector<Vertex>& vertices,
+                            std::vector<Face>& faces,
+                            double weldEpsilon = 0) {
+    using namespace MeshRepair;
+    MeshRepairReport report;
+    ThreadPool& pool = ThreadPool::shared();
+    const int numVertices = vertices.size();  // including the dummy
+
+    // Hash every vertex into its cell; cells list their vertices through
+    // 'nextInCell', lowest index first
+    const double cellSize = CELL_EPSILONS*weldEpsilon;
+    std::vector<CellKey> cells(numVertices);
+    pool.parallelFor(numVertices - 1, GRAIN, [&](size_t lo, size_t hi) {
+        for (size_t i = lo + 1; i < hi + 1; i++) {
+            cells[i] = cellOf(vertices[i], cellSize);
+        }
+    });
+    FlatMap<CellKey, int, CellKeyHash> firstInCell(numVertices);
+    std::vector<int> nextInCell(numVertices, 0);
+    for (int i = numVertices - 1; i >= 1; i--) {
+        auto inserted = firstInCell.insert(cells[i], i);
+        if (!inserted.second) {
+            nextInCell[i] = *inserted.first;
+            *inserted.first = i;
+        }
+    }
+
+    // Each vertex points at the lowest index within reach, which points at
+    // a lower one or itself, so one ascending pass resolves the chains
+    std::vector<int> weldTo(numVertices, 0);
+    pool.parallelFor(numVertices - 1, GRAIN, [&](size_t lo, size_t hi) {
+        for (size_t i = lo + 1; i < hi + 1; i++) {
+            const Vertex& p = vertices[i];
+            int best = i;
+            // cells within epsilon of 'p'; just its own for exact welding
+            CellKey first = cells[i], last = cells[i];
+            if (cellSize > 0) {
+                first = cellOf({p.x - weldEpsilon, p.y - weldEpsilon, p.z - weldEpsilon}, cellSize);
+                last = cellOf({p.x + weldEpsilon, p.y + weldEpsilon, p.z + weldEpsilon}, cellSize);
+            }
+            for (int64_t cx = first.x; cx <= last.x; cx++) {
+                for (int64_t cy = first.y; cy <= last.y; cy++) {
+                    for (int64_t cz = first.z; cz <= last.z; cz++) {
+                        const int* head = firstInCell.find({cx, cy, cz});
+                        if (!head) {
+                            continue;
+                        }
+                        for (int j = *head; j != 0 && j < best; j = nextInCell[j]) {
+                            const Vertex& q = vertices[j];
+                            if (std::abs(p.x - q.x) <= weldEpsilon &&
+                                std::abs(p.y - q.y) <= weldEpsilon &&
+                                std::abs(p.z - q.z) <= weldEpsilon) {
+                                best = j;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+            weldTo[i] = best;
+        }
+    });
+    for (int i = 1; i < numVertices; i++) {
+        weldTo[i] = weldTo[weldTo[i]];
+        if (weldTo[i] != i) {
+            report.weldedVertices++;
+        }
+    }
+    std::vector<CellKey>().swap(cells);
+    firstInCell = FlatMap<CellKey, int, CellKeyHash>(0);
+    std::vector<int>().swap(nextInCell);
+
+    // Remap faces and flag degenerate ones
+    std::vector<char> keep(faces.size());
+    pool.parallelFor(faces.size(), GRAIN, [&](size_t lo, size_t hi) {
+        for (size_t f = lo; f < hi; f++) {
+            Face& face = faces[f];
+            int* v = &face.v.i1;
+            keep[f] = false;
+            bool inRange = true;
+            for (int k = 0; k < 3; k++) {
+                inRange = inRange && v[k] >= 1 && v[k] < numVertices;
+            }
+            if (!inRange) {
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                v[k] = weldTo[v[k]];
+            }
+            if (v[0] == v[1] || v[1] == v[2] || v[0] == v[2]) {
+                continue;
+            }
+            const Vertex& a = vertices[v[0]];
+            const Vertex& b = vertices[v[1]];
+            const Vertex& c = vertices[v[2]];
+            double A[3] = {b.x - a.x, b.y - a.y, b.z - a.z};
+            double B[3] = {c.x - a.x, c.y - a.y, c.z - a.z};
+            double cx = A[1]*B[2] - A[2]*B[1];
+            double cy = A[2]*B[0] - A[0]*B[2];
+            double cz = A[0]*B[1] - A[1]*B[0];
+            double lenA = A[0]*A[0] + A[1]*A[1] + A[2]*A[2];
+            double lenB = B[0]*B[0] + B[1]*B[1] + B[2]*B[2];
+            // zero area, up to rounding (sin^2 of the corner angle)
+            keep[f] = cx*cx + cy*cy + cz*cz > 1e-24*lenA*lenB;
+        }
+    });
+
+    // Drop degenerate and duplicate faces, keeping the first of each set
+    FlatMap<FaceKey, char, FaceKeyHash> seen(faces.size());
+    size_t numKept = 0;
+    for (size_t f = 0; f < faces.size(); f++) {
+        if (!keep[f]) {
+            report.degenerateFaces++;
+            continue;
+        }
+        int s[3] = {faces[f].v.i1, faces[f].v.i2, faces[f].v.i3};
+        std::rotate(s, std::min_element(s, s + 3), s + 3);
+        if (!seen.insert({s[0], s[1], s[2]}, 0).second) {
+            report.duplicateFaces++;
+            continue;
+        }
+        faces[numKept++] = faces[f];
+    }
+    faces.resize(numKept);
+    seen = FlatMap<FaceKey, char, FaceKeyHash>(0);
+
+    // Renumber the vertices that are still used
+    std::vector<int> newIndex(numVertices, 0);
+    for (const Face& f : faces) {
+        newIndex[f.v.i1] = newIndex[f.v.i2] = newIndex[f.v.i3] = 1;
+    }
+    int numUsed = 1;
+    for (int i = 1; i < numVertices; i++) {
+        if (newIndex[i]) {
+            vertices[numUsed] = vertices[i];
+            newIndex[i] = numUsed++;
+        } else if (weldTo[i] == i) {
+            report.unusedVertices++;
+        }
+    }
+    vertices.resize(numUsed);
+    pool.parallelFor(faces.size(), GRAIN, [&](size_t lo, size_t hi) {
+        for (size_t f = lo; f < hi; f++) {
+            faces[f].v = {newIndex[faces[f].v.i1], newIndex[faces[f].v.i2],
+                          newIndex[faces[f].v.i3]};
+        }
+    });
+
+    // Count the faces on each edge
+    FlatMap<uint64_t, uint32_t, EdgeKeyHash> edgeUses(3*faces.size()/2);
+    for (const Face& f : faces) {
+        (*edgeUses.insert(edgeKey(f.v.i1, f.v.i2), 0).first)++;
+        (*edgeUses.insert(edgeKey(f.v.i2, f.v.i3), 0).first)++;
+        (*edgeUses.insert(edgeKey(f.v.i3, f.v.i1), 0).first)++;
+    }
+    edgeUses.forEach([&](uint64_t, uint32_t uses) {
+        if (uses == 1) {
+            report.boundaryEdges++;
+        } else if (uses > 2) {
+            report.nonManifoldEdges++;
+        }
+    });
+    return report;
+}
+
+#endif
@@ -0,0 +1,341 @@
+#ifndef SIMPLIFICATION_HPP
+#define SIMPLIFICATION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+#include "Eigen"
+#include "Types.hpp"
+#include "HalfedgeMesh.hpp"
+
+/** Sum of squared distances to a set of planes, as the symmetric 4x4
+    matrix of Garland and Heckbert, upper triangle only. */
+struct Quadric {
+    double a2{0}, ab{0}, ac{0}, ad{0};
+    double b2{0}, bc{0}, bd{0};
+    double c2{0}, cd{0};
+    double d2{0};
+
+    /** @brief Adds the plane ax + by + cz + d = 0, (a, b, c) unit length. */
+    void addPlane(double a, double b, double c, double d) {
+        a2 += a*a; ab += a*b; ac += a*c; ad += a*d;
+        b2 += b*b; bc += b*c; bd += b*d;
+        c2 += c*c; cd += c*d;
+        d2 += d*d;
+    }
+
+    Quadric& operator+=(const Quadric& q) {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+        return *this;
+    }
+
+    double evaluate(const Vertex& v) const {
+        double e = a2*v.x*v.x + 2*ab*v.x*v.y + 2*ac*v.x*v.z + 2*ad*v.x +
+                   b2*v.y*v.y + 2*bc*v.y*v.z + 2*bd*v.y +
+                   c2*v.z*v.z + 2*cd*v.z + d2;
+        return std::max(e, 0.0);
+    }
+
+    /** @return false if the minimum is not unique (the planes are all
+     *          parallel to some line), leaving 'v' alone. */
+    bool minimize(Vertex& v) const {
+        Eigen::Matrix3d A;
+        A << a2, ab, ac,
+             ab, b2, bc,
+             ac, bc, c2;
+        if (std::abs(A.determinant()) < 1e-12) {
+            return false;
+        }
+        Eigen::Vector3d x = A.inverse()*Eigen::Vector3d(-ad, -bd, -cd);
+        v = {x(0), x(1), x(2)};
+        return true;
+    }
+};
+
+/**
+ * Quadric error edge-collapse simplification (Garland and Heckbert,
+ * "Surface Simplification Using Quadric Error Metrics") of a closed
+ * manifold mesh in the 1-indexed .obj layout. Vertex quadrics and the
+ * initial edges come from a HalfedgeMesh; collapses then work on
+ * per-vertex face lists. Quadrics accumulate across calls to
+ * collapseTo(), so each call continues from the previous one and its error
+ * is measured against the original surface.
+ *
+ * A collapse is skipped if it would make the mesh non-manifold (the edge's
+ * endpoints share a neighbour besides its two opposite vertices) or flip a
+ * face.
+*/
+class QuadricSimplifier {
+public:
+    /** @param vertices, faces  must form a closed manifold; see repairMesh(). */
+    QuadricSimplifier(const std::vector<Vertex>& vertices,
+                      const std::vector<Face>& faces)
+        : positions{vertices}, quadrics(vertices.size()),
+          vertexFaces(vertices.size()), alive(vertices.size(), true),
+          version(vertices.size(), 0), mark(vertices.size(), 0),
+          liveFaces{faces.size()}
+    {
+        alive[0] = false;  // dummy
+        corners.reserve(faces.size());
+        faceAlive.assign(faces.size(), true);
+        for (size_t f = 0; f < faces.size(); f++) {
+            const Face& face = faces[f];
+            corners.push_back({(uint32_t) face.v.i1, (uint32_t) face.v.i2,
+                               (uint32_t) face.v.i3});
+            for (uint32_t v : corners.back().v) {
+                vertexFaces[v].push_back(f);
+            }
+        }
+
+        // Each vertex sums the planes of the faces around it, walking its
+        // one-ring; then each edge is queued from its lower-indexed end
+        HalfedgeMesh he;
+        he.build(vertices.size(), faces);
+        for (size_t i = 1; i < vertices.size(); i++) {
+            if (he.out[i] == HalfedgeMesh::INVALID) {
+                alive[i] = false;
+                continue;
+            }
+            he.forEachOutgoing(i, [&](int32_t h) {
+                addFacePlane(quadrics[i], vertices[he.vertex[h]],
+                             vertices[he.tip(h)], vertices[he.vertex[he.prev(h)]]);
+            });
+        }
+        for (size_t i = 1; i < vertices.size(); i++) {
+            he.forEachNeighbor(i, [&](int32_t j) {
+                if ((int32_t) i < j) {
+                    pushCandidate(i, j);
+                }
+            });
+        }
+    }
+
+    /**
+     * Collapses the cheapest edges until at most 'targetFaces' faces are
+     * left, or no edge can be collapsed.
+     * @return Largest error of any collapse so far: an upper bound, in
+     *         object space units, on the distance from a collapsed vertex
+     *         to the original planes around it.
+    */
+    double collapseTo(size_t targetFaces) {
+        while (liveFaces > targetFaces && liveFaces > 4 && !heap.empty()) {
+            Candidate c = heap.top();
+            heap.pop();
+            if (!alive[c.a] || !alive[c.b] ||
+                version[c.a] != c.versionA || version[c.b] != c.versionB) {
+                continue;  // stale
+            }
+            if (!canCollapse(c.a, c.b, c.target)) {
+                continue;
+            }
+            collapse(c.a, c.b, c.target);
+            maxError = std::max(maxError, std::sqrt(c.cost));
+        }
+        return maxError;
+    }
+
+    size_t numFaces() const {
+        return liveFaces;
+    }
+
+    /** @brief Writes the current mesh, renumbered, in the 1-indexed .obj
+     *         layout. Normal indices are left at 0. */
+    void extract(std::vector<Vertex>& outVertices, std::vector<Face>& outFaces) const {
+        std::vector<int> newIndex(positions.size(), 0);
+        outVertices.assign(1, Vertex{});  // dummy vertex for 1-indexing
+        for (size_t i = 1; i < positions.size(); i++) {
+            if (alive[i]) {
+                newIndex[i] = outVertices.size();
+                outVertices.push_back(positions[i]);
+            }
+        }
+        outFaces.clear();
+        outFaces.reserve(liveFaces);
+        for (size_t f = 0; f < corners.size(); f++) {
+            if (faceAlive[f]) {
+                const uint32_t* v = corners[f].v;
+                outFaces.push_back({{newIndex[v[0]], newIndex[v[1]], newIndex[v[2]]},
+                                    {0, 0, 0}});
+            }
+        }
+    }
+
+private:
+    struct Corners {
+        uint32_t v[3];
+    };
+
+    struct Candidate {
+        double cost;
+        uint32_t a, b;
+        uint32_t versionA, versionB;
+        Vertex target;
+
+        bool operator>(const Candidate& other) const {
+            return cost > other.cost;
+        }
+    };
+
+    static void addFacePlane(Quadric& q, const Vertex& p, const Vertex& r,
+                             const Vertex& s) {
+        Vertex n = faceNormal(p, r, s);
+        double len = std::sqrt(n.x*n.x + n.y*n.y + n.z*n.z);
+        if (len == 0) {
+            return;
+        }
+        n = {n.x/len, n.y/len, n.z/len};
+        q.addPlane(n.x, n.y, n.z, -(n.x*p.x + n.y*p.y + n.z*p.z));
+    }
+
+    static Vertex faceNormal(const Vertex& p, const Vertex& r, const Vertex& s) {
+        double ux = r.x - p.x, uy = r.y - p.y, uz = r.z - p.z;
+        double vx = s.x - p.x, vy = s.y - p.y, vz = s.z - p.z;
+        return {uy*vz - uz*vy, uz*vx - ux*vz, ux*vy - uy*vx};
+    }
+
+    /* Queues the collapse of edge (a, b) to the point of least error: the
+       quadric's minimum, or else the better of the endpoints and midpoint. */
+    void pushCandidate(uint32_t a, uint32_t b) {
+        Quadric q = quadrics[a];
+        q += quadrics[b];
+        const Vertex& pa = positions[a];
+        const Vertex& pb = positions[b];
+        Vertex target;
+        double cost;
+        if (q.minimize(target)) {
+            cost = q.evaluate(target);
+        } else {
+            Vertex mid = {(pa.x + pb.x)/2, (pa.y + pb.y)/2, (pa.z + pb.z)/2};
+            target = mid;
+            cost = q.evaluate(mid);
+            for (const Vertex& p : {pa, pb}) {
+                double e = q.evaluate(p);
+                if (e < cost) {
+                    cost = e;
+                    target = p;
+                }
+            }
+        }
+        heap.push({cost, a, b, version[a], version[b], target});
+    }
+
+    bool hasVertex(uint32_t f, uint32_t v) const {
+        const uint32_t* c = corners[f].v;
+        return c[0] == v || c[1] == v || c[2] == v;
+    }
+
+    bool canCollapse(uint32_t a, uint32_t b, const Vertex& target) {
+        // Link condition: on a closed manifold, a and b may share only the
+        // two vertices opposite their edge
+        generation++;
+        for (uint32_t f : vertexFaces[a]) {
+            if (faceAlive[f]) {
+                for (uint32_t v : corners[f].v) {
+                    mark[v] = generation;
+                }
+            }
+        }
+        size_t shared = 0;
+        for (uint32_t f : vertexFaces[b]) {
+            if (!faceAlive[f]) {
+                continue;
+            }
+            for (uint32_t v : corners[f].v) {
+                if (v != a && v != b && mark[v] == generation) {
+                    mark[v] = 0;  // count each once
+                    shared++;
+                }
+            }
+        }
+        if (shared != 2) {
+            return false;
+        }
+
+        // No remaining face around a or b may flip or collapse to a line
+        for (uint32_t end : {a, b}) {
+            for (uint32_t f : vertexFaces[end]) {
+                if (!faceAlive[f] || (hasVertex(f, a) && hasVertex(f, b))) {
+                    continue;
+                }
+                const uint32_t* c = corners[f].v;
+                Vertex before[3], after[3];
+                for (int k = 0; k < 3; k++) {
+                    before[k] = positions[c[k]];
+                    after[k] = c[k] == end ? target : before[k];
+                }
+                Vertex n0 = faceNormal(before[0], before[1], before[2]);
+                Vertex n1 = faceNormal(after[0], after[1], after[2]);
+                double dot = n0.x*n1.x + n0.y*n1.y + n0.z*n1.z;
+                double len0 = n0.x*n0.x + n0.y*n0.y + n0.z*n0.z;
+                double len1 = n1.x*n1.x + n1.y*n1.y + n1.z*n1.z;
+                if (dot <= 0.25*std::sqrt(len0*len1) || len1 == 0) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /* Moves a to 'target' and merges b into it. */
+    void collapse(uint32_t a, uint32_t b, const Vertex& target) {
+        positions[a] = target;
+        quadrics[a] += quadrics[b];
+        alive[b] = false;
+        version[a]++;
+
+        std::vector<uint32_t>& facesA = vertexFaces[a];
+        for (uint32_t f : vertexFaces[b]) {
+            if (!faceAlive[f]) {
+                continue;
+            }
+            if (hasVertex(f, a)) {
+                faceAlive[f] = false;
+                liveFaces--;
+                continue;
+            }
+            for (uint32_t& v : corners[f].v) {
+                if (v == b) {
+                    v = a;
+                }
+            }
+            facesA.push_back(f);
+        }
+        std::vector<uint32_t>().swap(vertexFaces[b]);
+        facesA.erase(std::remove_if(facesA.begin(), facesA.end(),
+                                    [&](uint32_t f) { return !faceAlive[f]; }),
+                     facesA.end());
+
+        // Requeue every edge out of a
+        generation++;
+        mark[a] = generation;
+        for (uint32_t f : facesA) {
+            for (uint32_t v : corners[f].v) {
+                if (mark[v] != generation) {
+                    mark[v] = generation;
+                    pushCandidate(a, v);
+                }
+            }
+        }
+    }
+
+    std::vector<Vertex> positions;
+    std::vector<Quadric> quadrics;
+    std::vector<Corners> corners;
+    std::vector<char> faceAlive;
+    std::vector<std::vector<uint32_t>> vertexFaces;  // may list dead faces
+    std::vector<char> alive;
+    std::vector<uint32_t> version;  // bumped when a vertex moves, staling its queued edges
+    std::vector<uint32_t> mark;
+    uint32_t generation{0};
+    size_t liveFaces;
+    double maxError{0};
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> heap;
+};
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef IMPOSTOR_HPP
+#define IMPOSTOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include "Eigen"
+#include "Types.hpp"
+#include "Lights.hpp"
+#include "Transformations.hpp"
+#include "CompactMesh.hpp"
+#include "Instance.hpp"
+
+/** Configuration of ImpostorCache; see Scene::setImpostorSettings. */
+struct ImpostorSettings {
+    bool enabled{false};
+    size_t spriteSize{64};      // texels per side; larger copies are rasterized
+    size_t maxSprites{256};     // least recently used sprites are evicted
+    double maxPixelError{1.0};  // re-render a sprite rather than be off by more
+    int directionBits{5};       // per octahedral axis of the view direction key
+};
+
+/** A copy rendered once into a square color and depth sprite, facing the
+    camera along 'viewDir'. */
+struct Impostor {
+    std::vector<Color> color;   // [u*size + v]
+    std::vector<float> depth;   // along 'viewDir' from the center; INF if empty
+    Vertex viewDir;             // unit, from the camera to the center
+    Vertex right, up;           // world directions of the sprite's u and v
+    double unitsPerTexel;       // world size of a texel at the center
+};
+
+/**
+ * Sprites of distant object copies, keyed by Object, material, shading
+ * algorithm, LOD level and quantized view direction, so copies of the same
+ * model seen from about the same direction are rasterized once and blitted
+ * after that. A sprite is re-rendered from the current copy when reusing it
+ * would be off by more than 'maxPixelError' pixels, from parallax or
+ * magnification.
+ *
+ * Sprites bake in the lighting they were rendered with, so the owner
+ * clear()s the cache whenever the lights or their shadow maps change;
+ * Scene does so in setLights, setShadowSettings and when a shadow map is
+ * rebuilt.
+ *
+ * Copies are placed where the software renderer draws them, at their
+ * Object's bounding sphere.
+*/
+class ImpostorCache {
+public:
+    struct Stats {
+        size_t blits;
+        size_t renders;
+    };
+
+    void setSettings(const ImpostorSettings& settings_) {
+        settings = settings_;
+        clear();
+    }
+
+    const ImpostorSettings& getSettings() const {
+        return settings;
+    }
+
+    Stats getStats() const {
+        return stats;
+    }
+
+    void clear() {
+        lru.clear();
+        entries.clear();
+    }
+
+    /**
+     * Draws 'copy' as an impostor into 'screenGrid' and 'minDepth'.
+     * @return false if it is not distant enough, or has no bounds; the
+     *         caller rasterizes it instead.
+    */
+    bool draw(const Instance& copy, size_t lodLevel, ShadingAlgo alg,
+              std::vector<PointLight>& lights, const Camera& camera,
+              Eigen::Matrix4d& worldToHomoNDC,
+              std::vector<std::vector<Color>>& screenGrid,
+              std::vector<std::vector<double>>& minDepth,
+              size_t xres, size_t yres) {
+        Vertex center;
+        double radius;
+        if (!copy.getObject().getBoundingSphere(center, radius) || radius <= 0) {
+            return false;
+        }
+
+        Eigen::Matrix4d R;
+        makeRotationMat(R, camera.orientation.x, camera.orientation.y,
+                        camera.orientation.z, camera.orientation.theta);
+        Vertex camRight = {R(0, 0), R(1, 0), R(2, 0)};
+        Vertex camUp = {R(0, 1), R(1, 1), R(2, 1)};
+        Vertex forward = {-R(0, 2), -R(1, 2), -R(2, 2)};
+        Vertex toCenter = {center.x - camera.pos.x, center.y - camera.pos.y,
+                           center.z - camera.pos.z};
+        double distance = std::sqrt(dot(toCenter, toCenter));
+        double eyeDepth = dot(toCenter, forward);
+        if (eyeDepth - radius <= camera.near || distance <= 2*radius) {
+            return false;
+        }
+        Vertex dir = {toCenter.x/distance, toCenter.y/distance, toCenter.z/distance};
+
+        // screen pixels per world unit at the center
+        double ppuX = xres*camera.near / ((camera.right - camera.left)*eyeDepth);
+        double ppuY = yres*camera.near / ((camera.top - camera.bottom)*eyeDepth);
+        double ppu = std::max(ppuX, ppuY);
+        if (2*radius*ppu > settings.spriteSize) {
+            return false;  // too close for a sprite to be sharp
+        }
+
+        Key key{&copy.getObject(), copy.material, alg, lodLevel, quantize(dir)};
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+        } else {
+            lru.push_front({key, Impostor{}});
+            it = entries.emplace(key, lru.begin()).first;
+            it->second->sprite.unitsPerTexel = 0;  // forces a render below
+            while (lru.size() > settings.maxSprites) {
+                entries.erase(lru.back().key);
+                lru.pop_back();
+            }
+        }
+        Impostor& sprite = it->second->sprite;
+
+        double parallax = std::acos(std::min(1.0, dot(dir, sprite.viewDir)))*radius*ppu;
+        if (sprite.unitsPerTexel == 0 || sprite.unitsPerTexel*ppu > 1 ||
+            parallax > settings.maxPixelError) {
+            render(sprite, copy, lodLevel, alg, lights, camera, radius, distance, dir);
+            stats.renders++;
+        }
+        blit(sprite, center, radius, dir, camRight, camUp, ppuX, ppuY,
+             worldToHomoNDC, screenGrid, minDepth, xres, yres);
+        stats.blits++;
+        return true;
+    }
+
+private:
+    struct Key {
+        const Object* object;
+        Material material;
+        ShadingAlgo alg;
+        size_t lodLevel;
+        uint32_t direction;
+
+        bool operator==(const Key& other) const {
+            return object == other.object && alg == other.alg &&
+                   lodLevel == other.lodLevel && direction == other.direction &&
+                   sameColor(material.ambient, other.material.ambient) &&
+                   sameColor(material.diffuse, other.material.diffuse) &&
+                   sameColor(material.specular, other.material.specular) &&
+                   material.shininess == other.material.shininess;
+        }
+
+        static bool sameColor(const Color& a, const Color& b) {
+            return a.r == b.r && a.g == b.g && a.b == b.b;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            size_t h = std::hash<const void*>()(k.object);
+            h ^= std::hash<uint32_t>()(k.direction ^ ((uint32_t) k.alg << 30)) +
+                 0x9e3779b9 + (h << 6) + (h >> 2);
+            h ^= std::hash<size_t>()(k.lodLevel) + 0x9e3779b9 + (h << 6) + (h >> 2);
+            const Material& m = k.material;
+            for (double x : {m.ambient.r, m.ambient.g, m.ambient.b,
+                             m.diffuse.r, m.diffuse.g, m.diffuse.b,
+                             m.specular.r, m.specular.g, m.specular.b,
+                             m.shininess}) {
+                h ^= std::hash<double>()(x) + 0x9e3779b9 + (h << 6) + (h >> 2);
+            }
+            return h;
+        }
+    };
+
+    struct Entry {
+        Key key;
+        Impostor sprite;
+    };
+
+    static double dot(const Vertex& a, const Vertex& b) {
+        return a.x*b.x + a.y*b.y + a.z*b.z;
+    }
+
+    /* Octahedral cell of 'dir', 'directionBits' per axis. */
+    uint32_t quantize(const Vertex& dir) const {
+        uint32_t packed = encodeOctNormal(dir);
+        uint32_t u = (uint16_t) ((packed & 0xffff) ^ 0x8000);  // to unsigned
+        uint32_t v = (uint16_t) ((packed >> 16) ^ 0x8000);
+        int shift = 16 - std::clamp(settings.directionBits, 1, 15);
+        return (u >> shift) | ((v >> shift) << 16);
+    }
+
+    /* Rasterizes the copy through a camera at the real camera's position,
+       aimed at the center, with a frustum just around the bounding sphere. */
+    void render(Impostor& sprite, const Instance& copy, size_t lodLevel,
+                ShadingAlgo alg, std::vector<PointLight>& lights,
+                const Camera& camera, double radius, double distance,
+                const Vertex& dir) const {
+        const size_t size = settings.spriteSize;
+
+        // rotate -z onto 'dir'
+        Camera view = camera;
+        Vertex axis = {dir.y, -dir.x, 0};  // -z cross dir
+        double axisLen = std::sqrt(dot(axis, axis));
+        if (axisLen < 1e-12) {
+            view.orientation = {0, 1, 0, dir.z < 0 ? 0 : M_PI};
+        } else {
+            view.orientation = {axis.x/axisLen, axis.y/axisLen, axis.z/axisLen,
+                                std::acos(std::clamp(-dir.z, -1.0, 1.0))};
+        }
+        double margin = 1.01*radius;
+        view.near = distance - margin;
+        view.far = distance + margin;
+        double half = view.near*margin / std::sqrt(distance*distance - margin*margin);
+        view.left = view.bottom = -half;
+        view.right = view.top = half;
+
+        Eigen::Matrix4d worldToCamera, perspective;
+        makeWorldToCameraProj(worldToCamera, view);
+        makePerspectiveProjection(perspective, view);
+        Eigen::Matrix4d viewToHomoNDC = perspective*worldToCamera;
+
+        const double INF = std::numeric_limits<double>::max();
+        std::vector<std::vector<Color>> color(size, std::vector<Color>(size, Color{0, 0, 0}));
+        std::vector<std::vector<double>> depth(size, std::vector<double>(size, INF));
+        Vertex cameraPos = camera.pos;
+        copy.renderShadedObj(color, size, size, alg, lights, cameraPos,
+                             viewToHomoNDC, depth, lodLevel);
+
+        Eigen::Matrix4d R;
+        makeRotationMat(R, view.orientation.x, view.orientation.y,
+                        view.orientation.z, view.orientation.theta);
+        sprite.viewDir = dir;
+        sprite.right = {R(0, 0), R(1, 0), R(2, 0)};
+        sprite.up = {R(0, 1), R(1, 1), R(2, 1)};
+        sprite.unitsPerTexel = 2*half*distance / (view.near*size);
+        sprite.color.resize(size*size);
+        sprite.depth.assign(size*size, std::numeric_limits<float>::infinity());
+        double n = view.near, f = view.far;
+        for (size_t u = 0; u < size; u++) {
+            for (size_t v = 0; v < size; v++) {
+                if (depth[u][v] == INF) {
+                    continue;
+                }
+                // NDC depth back to distance along the view axis
+                double eye = 2*f*n / ((f + n) - depth[u][v]*(f - n));
+                sprite.color[u*size + v] = color[u][v];
+                sprite.depth[u*size + v] = eye - distance;
+            }
+        }
+    }
+
+    /* Samples the sprite, nearest texel, at every pixel the copy's bounding
+       sphere may cover, depth testing each against 'minDepth'. */
+    void blit(const Impostor& sprite, const Vertex& center, double radius,
+              const Vertex& dir, const Vertex& camRight, const Vertex& camUp,
+              double ppuX, double ppuY, const Eigen::Matrix4d& worldToHomoNDC,
+              std::vector<std::vector<Color>>& screenGrid,
+              std::vector<std::vector<double>>& minDepth,
+              size_t xres, size_t yres) const {
+        const long size = settings.spriteSize;
+        Vertex c = worldToNDC(worldToHomoNDC, center);
+        double cx = (c.x + 1)/2*xres;
+        double cy = (c.y + 1)/2*yres;
+        long x0 = std::max(0L, (long) std::floor(cx - radius*ppuX) - 1);
+        long x1 = std::min((long) xres - 1, (long) std::ceil(cx + radius*ppuX) + 1);
+        long y0 = std::max(0L, (long) std::floor(cy - radius*ppuY) - 1);
+        long y1 = std::min((long) yres - 1, (long) std::ceil(cy + radius*ppuY) + 1);
+
+        for (long x = x0; x <= x1; x++) {
+            for (long y = y0; y <= y1; y++) {
+                double wx = (x + 0.5 - cx)/ppuX;
+                double wy = (y + 0.5 - cy)/ppuY;
+                Vertex w = {wx*camRight.x + wy*camUp.x, wx*camRight.y + wy*camUp.y,
+                            wx*camRight.z + wy*camUp.z};
+                long u = (long) std::floor(dot(w, sprite.right)/sprite.unitsPerTexel + size/2.0);
+                long v = (long) std::floor(dot(w, sprite.up)/sprite.unitsPerTexel + size/2.0);
+                if (u < 0 || u >= size || v < 0 || v >= size) {
+                    continue;
+                }
+                float offset = sprite.depth[u*size + v];
+                if (std::isinf(offset)) {
+                    continue;
+                }
+                Vertex p = {center.x + w.x + dir.x*offset, center.y + w.y + dir.y*offset,
+                            center.z + w.z + dir.z*offset};
+                double z = worldToNDC(worldToHomoNDC, p).z;
+                if (-1 <= z && z <= 1 && z < minDepth[x][y]) {
+                    minDepth[x][y] = z;
+                    screenGrid[x][y] = sprite.color[u*size + v];
+                }
+            }
+        }
+    }
+
+    ImpostorSettings settings;
+    std::list<Entry> lru;  // most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entries;
+    Stats stats{0, 0};
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef INDEXED_MESH_HPP
+#define INDEXED_MESH_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Types.hpp"
+#include "Mesh.hpp"
+#include "Meshlets.hpp"
+
+/** Interleaved position and normal, laid out for glVertexPointer and
+    glNormalPointer with a stride of sizeof(IndexedVertex). */
+struct IndexedVertex {
+    float px, py, pz;
+    float nx, ny, nz;
+
+    Vertex position() const {
+        return {px, py, pz};
+    }
+
+    Vertex normal() const {
+        return {nx, ny, nz};
+    }
+};
+
+/**
+ * Render layout of a Mesh: one vertex per distinct (v, vn) pair of the .obj
+ * and a single index buffer, 3 entries per triangle, 0-indexed. On a closed
+ * mesh each vertex is shared by about six triangles, so both renderers
+ * transform and light it once instead of once per corner.
+*/
+struct IndexedMesh {
+    std::vector<IndexedVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<Meshlet> meshlets;  // partition of 'indices'; see buildMeshlets
+
+    size_t numFaces() const {
+        return indices.size() / 3;
+    }
+
+    size_t numBytes() const {
+        return vertices.capacity()*sizeof(IndexedVertex) +
+               indices.capacity()*sizeof(uint32_t) +
+               meshlets.capacity()*sizeof(Meshlet);
+    }
+
+    void buildMeshlets() {
+        meshlets = ::buildMeshlets(indices, vertices.size(),
+                                   [this](uint32_t i) { return vertices[i].position(); });
+    }
+};
+
+/** @brief Welds the (position, normal) index pairs of 'mesh' into one
+ *         vertex each. */
+IndexedMesh makeIndexedMesh(const Mesh& mesh) {
+    IndexedMesh out;
+    std::unordered_map<uint64_t, uint32_t> pairToVertex;
+    pairToVertex.reserve(mesh.vertices.size());
+    out.vertices.reserve(mesh.vertices.size());
+    out.indices.reserve(3*mesh.faces.size());
+
+    for (const Face& f : mesh.faces) {
+        const int* v = &f.v.i1;
+        const int* n = &f.n.i1;
+        for (int k = 0; k < 3; k++) {
+            uint64_t key = ((uint64_t) (uint32_t) v[k] << 32) | (uint32_t) n[k];
+            auto it = pairToVertex.find(key);
+            if (it == pairToVertex.end()) {
+                it = pairToVertex.emplace(key, (uint32_t) out.vertices.size()).first;
+                const Vertex& p = mesh.vertices[v[k]];
+                const Vertex& nv = mesh.normals[n[k]];
+                out.vertices.push_back({(float) p.x, (float) p.y, (float) p.z,
+                                        (float) nv.x, (float) nv.y, (float) nv.z});
+            }
+            out.indices.push_back(it->second);
+        }
+    }
+    out.vertices.shrink_to_fit();
+    return out;
+}
+
+/** @brief Expands 'indexed' back into the 1-indexed Mesh layout. */
+Mesh expandIndexedMesh(const IndexedMesh& indexed) {
+    Mesh mesh;
+    mesh.vertices.reserve(indexed.vertices.size() + 1);
+    mesh.normals.reserve(indexed.vertices.size() + 1);
+    mesh.vertices.emplace_back();  // dummy vertex for 1-indexing
+    mesh.normals.emplace_back();
+    for (const IndexedVertex& v : indexed.vertices) {
+        mesh.vertices.push_back(v.position());
+        mesh.normals.push_back(v.normal());
+    }
+    mesh.faces.reserve(indexed.numFaces());
+    for (size_t f = 0; f < indexed.numFaces(); f++) {
+        int i1 = indexed.indices[3*f] + 1;
+        int i2 = indexed.indices[3*f + 1] + 1;
+        int i3 = indexed.indices[3*f + 2] + 1;
+        mesh.faces.push_back({{i1, i2, i3}, {i1, i2, i3}});
+    }
+    return mesh;
+}
+
+/* Welds at load time; the parsed Mesh is dropped afterwards. */
+void loadOBJ(const std::string& fname, IndexedMesh& indexed, double weldEpsilon = 0) {
+    Mesh mesh;
+    loadOBJ(fname, mesh, weldEpsilon);
+    indexed = makeIndexedMesh(mesh);
+    indexed.buildMeshlets();
+}
+
+#endif
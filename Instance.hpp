@@ -0,0 +1,86 @@
+#ifndef INSTANCE_HPP
+#define INSTANCE_HPP
+
+#include <memory>
+#include <vector>
+#include "Eigen"
+#include "Types.hpp"
+#include "Objects.hpp"
+
+/**
+ * One entry of the object copies section: a reference to the shared,
+ * immutable Object plus what is specific to the copy. Making a copy costs
+ * a few hundred bytes no matter how large the mesh is.
+*/
+class Instance {
+public:
+    explicit Instance(std::shared_ptr<const Object> object_)
+        : object{std::move(object_)} {}
+
+    void addTransformation(Eigen::Matrix4d& t) {
+        transformation = t*transformation;
+    }
+
+    void addNormalTransformation(Eigen::Matrix4d& t) {
+        normalTrans = t*normalTrans;
+    }
+
+    void recordTransformation(Type tt, float* params) {
+        TransformationRecord tr;
+        tr.tt = tt;
+        tr.params[0] = params[0];
+        tr.params[1] = params[1];
+        tr.params[2] = params[2];
+        tr.params[3] = params[3];
+        transSeq.push_back(tr);
+    }
+
+    void setMaterialProperties(Color& a, Color& d,
+                               Color& s, double sns) {
+        material = {a, d, s, sns};
+    }
+
+    const Object& getObject() const {
+        return *object;
+    }
+
+    const Eigen::Matrix4d& getTransformation() const {
+        return transformation;
+    }
+
+    const Eigen::Matrix4d& getNormalTransformation() const {
+        return normalTrans;
+    }
+
+    void fillScreenCoords(std::vector<std::vector<bool>>& screenCoords,
+                          size_t xres, size_t yres) const {
+        object->fillScreenCoords(screenCoords, xres, yres);
+    }
+
+    void renderWireframe(Bitplane& plane, size_t xres, size_t yres) const {
+        object->renderWireframe(plane, xres, yres);
+    }
+
+    void renderShadedObj(std::vector<std::vector<Color>>& screenGrid,
+                         size_t xres, size_t yres, ShadingAlgo alg,
+                         std::vector<PointLight>& lights, Vertex& cameraPos,
+                         Eigen::Matrix4d& worldToHomoNDC,
+                         std::vector<std::vector<double>>& minDepth,
+                         size_t lodLevel = 0) const {
+        object->renderShadedObj(material, screenGrid, xres, yres, alg, lights,
+                                cameraPos, worldToHomoNDC, minDepth, lodLevel);
+    }
+
+    Material material;
+    std::vector<TransformationRecord> transSeq;
+
+private:
+    std::shared_ptr<const Object> object;
+
+    /** Product of all transformations:  geometric transformations, world-to-camera projection,
+        perspective projection. */
+    Eigen::Matrix4d transformation{Eigen::Matrix4d::Identity()};
+    Eigen::Matrix4d normalTrans{Eigen::Matrix4d::Identity()};
+};
+
+#endif
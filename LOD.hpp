@@ -0,0 +1,144 @@
+#ifndef LOD_HPP
+#define LOD_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Eigen"
+#include "Types.hpp"
+#include "Mesh.hpp"
+#include "IndexedMesh.hpp"
+#include "VertexCache.hpp"
+#include "MeshRepair.hpp"
+#include "Simplification.hpp"
+
+/**
+ * A mesh and successively simplified versions of it. Level 0 is the mesh
+ * as loaded; each level after it has about half the faces of the one
+ * before. Every level is ordered for the vertex cache and has meshlets.
+*/
+struct LODMesh {
+    static const size_t MAX_LEVELS = 8;
+    static const size_t MIN_FACES = 32;  // no level is simplified further
+
+    std::vector<IndexedMesh> levels;
+    std::vector<double> errors;  // per level, object space; 0 for level 0
+
+    // Bounding sphere of level 0, object space
+    Vertex center{0, 0, 0};
+    double radius{0};
+
+    size_t numBytes() const {
+        size_t bytes = 0;
+        for (const IndexedMesh& level : levels) {
+            bytes += level.numBytes();
+        }
+        return bytes;
+    }
+};
+
+/* Cache orders and meshlets a level. */
+inline void finishLODLevel(IndexedMesh& level) {
+    optimizeVertexCache(level.indices, level.vertices.size());
+    optimizeVertexFetch(level);
+    level.buildMeshlets();
+}
+
+/**
+ * Loads 'fname' and builds its LOD chain with QuadricSimplifier. Meshes
+ * that are not closed manifolds are kept at level 0 only. Simplified
+ * levels get area-weighted vertex normals.
+*/
+void loadOBJ(const std::string& fname, LODMesh& lod, double weldEpsilon = 0) {
+    Mesh mesh;
+    loadOBJ(fname, mesh, weldEpsilon);
+    lod.levels.clear();
+    lod.errors.clear();
+    lod.levels.push_back(makeIndexedMesh(mesh));
+    lod.errors.push_back(0);
+    finishLODLevel(lod.levels[0]);
+
+    Vertex lo = {0, 0, 0}, hi = lo;
+    if (mesh.vertices.size() > 1) {
+        lo = hi = mesh.vertices[1];
+    }
+    for (size_t i = 1; i < mesh.vertices.size(); i++) {
+        const Vertex& p = mesh.vertices[i];
+        lo = {std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z)};
+        hi = {std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z)};
+    }
+    lod.center = {(lo.x + hi.x)/2, (lo.y + hi.y)/2, (lo.z + hi.z)/2};
+    double r2 = 0;
+    for (size_t i = 1; i < mesh.vertices.size(); i++) {
+        const Vertex& p = mesh.vertices[i];
+        double dx = p.x - lod.center.x, dy = p.y - lod.center.y, dz = p.z - lod.center.z;
+        r2 = std::max(r2, dx*dx + dy*dy + dz*dz);
+    }
+    lod.radius = std::sqrt(r2);
+
+    if (!mesh.repair.isClosedManifold()) {
+        std::cerr << fname << ": not a closed manifold, no LOD levels" << std::endl;
+        return;
+    }
+
+    QuadricSimplifier simplifier{mesh.vertices, mesh.faces};
+    while (lod.levels.size() < LODMesh::MAX_LEVELS) {
+        size_t before = simplifier.numFaces();
+        size_t target = before / 2;
+        if (target < LODMesh::MIN_FACES) {
+            break;
+        }
+        double error = simplifier.collapseTo(target);
+        if (simplifier.numFaces() > before - before/10) {
+            break;  // stuck: nothing left that can be collapsed safely
+        }
+        Mesh level;
+        simplifier.extract(level.vertices, level.faces);
+        level.normals.assign(1, Vertex{});
+        computeVertexNormals(level.normals, level.vertices, level.faces);
+        for (Face& f : level.faces) {
+            f.n = f.v;
+        }
+        lod.levels.push_back(makeIndexedMesh(level));
+        lod.errors.push_back(error);
+        finishLODLevel(lod.levels.back());
+    }
+}
+
+/**
+ * Picks the coarsest level of 'lod' whose error projects to at most
+ * 'maxPixelError' pixels, for a copy placed by 'objectToWorld' and seen
+ * through 'camera' at 'xres' x 'yres'. The error is projected at the point
+ * of the copy's bounding sphere nearest the camera, and scaled by the
+ * largest scale factor in 'objectToWorld'.
+*/
+size_t selectLODLevel(const LODMesh& lod, const Eigen::Matrix4d& objectToWorld,
+                      const Camera& camera, size_t xres, size_t yres,
+                      double maxPixelError = 1.0) {
+    Eigen::Vector4d c = objectToWorld*Eigen::Vector4d(lod.center.x, lod.center.y,
+                                                      lod.center.z, 1);
+    double scale = std::max({objectToWorld.block<3, 1>(0, 0).norm(),
+                             objectToWorld.block<3, 1>(0, 1).norm(),
+                             objectToWorld.block<3, 1>(0, 2).norm()});
+    double dx = c(0) - camera.pos.x, dy = c(1) - camera.pos.y, dz = c(2) - camera.pos.z;
+    double distance = std::sqrt(dx*dx + dy*dy + dz*dz) - scale*lod.radius;
+    if (distance <= camera.near) {
+        return 0;
+    }
+
+    // pixels per world unit on the near plane, projected to 'distance'
+    double pixelsPerUnit = std::max(xres / (camera.right - camera.left),
+                                    yres / (camera.top - camera.bottom));
+    pixelsPerUnit *= camera.near / distance;
+
+    size_t level = 0;
+    while (level + 1 < lod.levels.size() &&
+           scale*lod.errors[level + 1]*pixelsPerUnit <= maxPixelError) {
+        level++;
+    }
+    return level;
+}
+
+#endif
@@ -4,9 +4,10 @@
 #include <vector>
 #include "Eigen"
 #include "Types.hpp"
+#include "CubeShadowMap.hpp"
 
 enum ShadingAlgo {
-    NONE,
+    NONE,     // depth only, as for shadow maps
     GOURAUD,  // interpolates color directly
     PHONG     // interpolates NDC coords and normals, to get color
 };
@@ -20,6 +21,8 @@ enum ShadingAlgo {
  * @param shininess
  * @param lights
  * @param e - camera position
+ *
+ * A light with a shadow map is scaled by how much of it reaches 'p'.
  */
 Color LightingModel(Vertex point, Vertex normal,
                     Color diffuse, Color ambient,
@@ -57,6 +60,13 @@ Color LightingModel(Vertex point, Vertex normal,
         Eigen::Vector3d l = lp - P;
         double d_sq = l(0)*l(0) + l(1)*l(1) + l(2)*l(2);
         lc = lc/(1+k*d_sq);
+        if (light.shadow) {
+            double visible = light.shadow->visibility(P, n);
+            if (visible <= 0) {
+                continue;
+            }
+            lc *= visible;
+        }
 
         Eigen::Vector3d l_direction = l.normalized();
 
@@ -0,0 +1,120 @@
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <string_view>
+#include <iostream>
+#include "Types.hpp"
+#include "Util.hpp"
+#include "DiscreteDifferentialGeometry.hpp"
+#include "MeshRepair.hpp"
+
+/** Geometry parsed from a .obj file. Index 0 of 'vertices' and 'normals'
+    is a dummy entry, since .obj files are 1-indexed. */
+struct Mesh {
+    std::vector<Vertex> vertices;
+    std::vector<Vertex> normals;
+    std::vector<Face> faces;
+    MeshRepairReport repair;  // what loadOBJ's repairMesh changed and found
+};
+
+/**
+ * Populates 'mesh' from the .obj file 'fname'. Polygons are split into
+ * triangle fans, and malformed lines are reported with their line number
+ * and skipped. Vertices closer than 'weldEpsilon' (exact duplicates if it
+ * is 0) are welded and degenerate or duplicate faces dropped; see
+ * repairMesh and 'mesh.repair'.
+ * If the file has no 'vn' lines, normals are computed with the
+ * area-weighted algorithm.
+*/
+void loadOBJ(const std::string& fname, Mesh& mesh, double weldEpsilon = 0) {
+    std::vector<Vertex>& vertices = mesh.vertices;
+    std::vector<Vertex>& normals = mesh.normals;
+    std::vector<Face>& faces = mesh.faces;
+
+    vertices.emplace_back();  // dummy vertex for 1-indexing
+    normals.emplace_back();
+
+    std::ifstream file{fname};
+    std::string currLine;
+    std::vector<int> vBuff, nBuff;  // corners of the current face
+    size_t lineNo = 0;
+    auto error = [&](const char* msg) {
+        return reportParseError(fname, lineNo, msg);
+    };
+
+    std::getline(file, currLine);
+    lineNo++;
+
+    while (file) {
+        std::string hdr = currLine.substr(0, currLine.find(' '));
+        if (hdr == "v" || hdr == "vn") {
+            double buff[3];
+            std::string_view s;
+            if (parse_parameter_str(std::string_view{currLine}, s, buff, 3) != 3) {
+                error("expected three coordinates, line skipped");
+            } else {
+                Vertex v = {buff[0], buff[1], buff[2]};
+                (hdr == "v" ? vertices : normals).push_back(v);
+            }
+        } else if (hdr == "f") {
+            // polygons are split into a fan of triangles around corner 0
+            vBuff.clear();
+            nBuff.clear();
+            std::string_view rest{currLine};
+            std::string_view token;
+            next_token(rest, token);  // reads 'f'
+            bool ok = true;
+            while (ok && next_token(rest, token)) {
+                int v = 0, n = 0;
+                ok = parseFaceCorner(token, vertices.size() - 1, normals.size() - 1, v, n) &&
+                     v >= 1 && (size_t) v < vertices.size() &&
+                     n >= 0 && (size_t) n < normals.size();
+                vBuff.push_back(v);
+                nBuff.push_back(n);
+            }
+            if (!ok) {
+                error("malformed or out-of-range face corner, face skipped");
+            } else if (vBuff.size() < 3) {
+                error("face has fewer than three corners, face skipped");
+            } else {
+                for (size_t k = 2; k < vBuff.size(); k++) {
+                    Face f = {{vBuff[0], vBuff[k - 1], vBuff[k]},
+                              {nBuff[0], nBuff[k - 1], nBuff[k]}};
+                    faces.push_back(f);
+                }
+            }
+        } else {
+            std::cout << "ERROR: parsing .obj unknown hdr "
+                      << hdr << std::endl;
+        }
+
+        std::getline(file, currLine);
+        lineNo++;
+    }
+
+    mesh.repair = repairMesh(vertices, faces, weldEpsilon);
+    const MeshRepairReport& report = mesh.repair;
+    if (report.weldedVertices || report.degenerateFaces || report.duplicateFaces) {
+        std::cerr << fname << ": welded " << report.weldedVertices
+                  << " vertices, dropped " << report.degenerateFaces
+                  << " degenerate and " << report.duplicateFaces
+                  << " duplicate faces" << std::endl;
+    }
+    if (report.nonManifoldEdges) {
+        std::cerr << "WARNING: " << fname << " has " << report.nonManifoldEdges
+                  << " non-manifold edges" << std::endl;
+    }
+
+    if (normals.size() == 1) {
+        // one normal per vertex, sharing the vertex indices
+        computeVertexNormals(normals, vertices, faces);
+        for (Face& f : faces) {
+            f.n = f.v;
+        }
+    }
+}
+
+#endif
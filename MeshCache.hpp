@@ -0,0 +1,127 @@
+#ifndef MESH_CACHE_HPP
+#define MESH_CACHE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include "Mesh.hpp"
+#include "CompactMesh.hpp"
+#include "IndexedMesh.hpp"
+#include "VertexCache.hpp"
+#include "LOD.hpp"
+
+/**
+ * Process-wide cache of parsed meshes. Entries are keyed by canonical
+ * path and revalidated against the file's size and modification time and
+ * the weld epsilon, so an edited .obj is parsed again while an unchanged
+ * one is parsed once for every label and scene that references it.
+ * 'MeshT' is any layout with a loadOBJ(fname, MeshT&, weldEpsilon)
+ * overload.
+*/
+template <typename MeshT>
+class MeshCacheT {
+public:
+    struct Stats {
+        size_t hits;
+        size_t misses;
+    };
+
+    static MeshCacheT& shared() {
+        static MeshCacheT cache;
+        return cache;
+    }
+
+    /**
+     * @return The mesh in 'fname', its vertices welded within
+     *         'weldEpsilon' (see repairMesh). Concurrent requests for the
+     *         same file wait on a single parse. Files that cannot be
+     *         stat'ed are parsed without being cached.
+    */
+    std::shared_ptr<const MeshT> get(const std::string& fname, double weldEpsilon = 0) {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        fs::path path = fs::canonical(fname, ec);
+        uintmax_t size = ec ? 0 : fs::file_size(path, ec);
+        fs::file_time_type mtime = ec ? fs::file_time_type{} : fs::last_write_time(path, ec);
+        if (ec) {
+            {
+                std::lock_guard<std::mutex> lock{mtx};
+                stats.misses++;
+            }
+            return load(fname, weldEpsilon);
+        }
+
+        std::promise<std::shared_ptr<const MeshT>> promise;
+        std::shared_future<std::shared_ptr<const MeshT>> result;
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            auto it = entries.find(path.string());
+            if (it != entries.end() && it->second.size == size &&
+                it->second.mtime == mtime && it->second.weldEpsilon == weldEpsilon) {
+                stats.hits++;
+                result = it->second.mesh;
+            } else {
+                stats.misses++;
+                entries[path.string()] = {size, mtime, weldEpsilon,
+                                          promise.get_future().share()};
+            }
+        }
+        if (result.valid()) {
+            return result.get();
+        }
+
+        std::shared_ptr<const MeshT> mesh;
+        try {
+            mesh = load(path.string(), weldEpsilon);
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+            std::lock_guard<std::mutex> lock{mtx};
+            entries.erase(path.string());
+            throw;
+        }
+        promise.set_value(mesh);
+        return mesh;
+    }
+
+    Stats getStats() {
+        std::lock_guard<std::mutex> lock{mtx};
+        return stats;
+    }
+
+    /** @brief Drops every entry. Meshes still referenced stay alive. */
+    void clear() {
+        std::lock_guard<std::mutex> lock{mtx};
+        entries.clear();
+    }
+
+private:
+    struct Entry {
+        uintmax_t size;
+        std::filesystem::file_time_type mtime;
+        double weldEpsilon;
+        std::shared_future<std::shared_ptr<const MeshT>> mesh;
+    };
+
+    static std::shared_ptr<const MeshT> load(const std::string& fname, double weldEpsilon) {
+        std::shared_ptr<MeshT> mesh = std::make_shared<MeshT>();
+        loadOBJ(fname, *mesh, weldEpsilon);
+        return mesh;
+    }
+
+    std::mutex mtx;
+    std::unordered_map<std::string, Entry> entries;
+    Stats stats{0, 0};
+};
+
+using MeshCache = MeshCacheT<Mesh>;
+using CompactMeshCache = MeshCacheT<CompactMesh>;
+using IndexedMeshCache = MeshCacheT<IndexedMesh>;
+using CacheOptimizedMeshCache = MeshCacheT<CacheOptimizedMesh>;
+using LODMeshCache = MeshCacheT<LODMesh>;
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef MESHLETS_HPP
+#define MESHLETS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "Types.hpp"
+
+/**
+ * A run of consecutive triangles of an index buffer, touching at most
+ * MAX_VERTICES distinct vertices, with bounds for culling the whole run:
+ * a bounding sphere, and a cone that contains every triangle normal.
+*/
+struct Meshlet {
+    static const uint32_t MAX_VERTICES = 64;
+    static const uint32_t MAX_TRIANGLES = 124;
+
+    uint32_t firstTriangle;
+    uint32_t numTriangles;
+    float center[3];
+    float radius;
+    float coneAxis[3];   // 0 if the normals do not fit in a half space
+    float coneCutoff;    // sine of the cone's half angle; 1 never culls
+
+    /**
+     * @return true if every triangle faces away from a camera at
+     *         'cameraPos' (perspective), so the meshlet can be skipped.
+    */
+    bool isBackFacing(const Vertex& cameraPos) const {
+        double dx = center[0] - cameraPos.x;
+        double dy = center[1] - cameraPos.y;
+        double dz = center[2] - cameraPos.z;
+        double dist = std::sqrt(dx*dx + dy*dy + dz*dz);
+        double along = dx*coneAxis[0] + dy*coneAxis[1] + dz*coneAxis[2];
+        return along >= coneCutoff*dist + radius;
+    }
+};
+
+/**
+ * Splits 'indices' into meshlets, greedily in index order, so it works
+ * best on an index buffer already ordered for locality (see
+ * optimizeVertexCache). 'positionAt(i)' returns the position of vertex i.
+ * Linear in the number of triangles.
+*/
+template <typename PositionAt>
+std::vector<Meshlet> buildMeshlets(const std::vector<uint32_t>& indices,
+                                   size_t numVertices, PositionAt&& positionAt) {
+    std::vector<Meshlet> meshlets;
+    size_t numFaces = indices.size() / 3;
+    // 'seenIn[v]' is 1 + the meshlet that last counted v
+    std::vector<uint32_t> seenIn(numVertices, 0);
+
+    size_t first = 0;
+    while (first < numFaces) {
+        uint32_t id = meshlets.size() + 1;
+        uint32_t numUnique = 0;
+        size_t last = first;
+        while (last < numFaces && last - first < Meshlet::MAX_TRIANGLES) {
+            uint32_t added = 0;
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = indices[3*last + k];
+                added += seenIn[v] != id && (k < 1 || v != indices[3*last]) &&
+                         (k < 2 || v != indices[3*last + 1]);
+            }
+            if (numUnique + added > Meshlet::MAX_VERTICES) {
+                break;
+            }
+            for (int k = 0; k < 3; k++) {
+                seenIn[indices[3*last + k]] = id;
+            }
+            numUnique += added;
+            last++;
+        }
+
+        Meshlet m;
+        m.firstTriangle = first;
+        m.numTriangles = last - first;
+
+        // Bounding sphere around the center of the bounding box
+        Vertex lo = positionAt(indices[3*first]), hi = lo;
+        for (size_t i = 3*first; i < 3*last; i++) {
+            Vertex p = positionAt(indices[i]);
+            lo = {std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z)};
+            hi = {std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z)};
+        }
+        Vertex c = {(lo.x + hi.x)/2, (lo.y + hi.y)/2, (lo.z + hi.z)/2};
+        double r2 = 0;
+        for (size_t i = 3*first; i < 3*last; i++) {
+            Vertex p = positionAt(indices[i]);
+            double dx = p.x - c.x, dy = p.y - c.y, dz = p.z - c.z;
+            r2 = std::max(r2, dx*dx + dy*dy + dz*dz);
+        }
+        m.center[0] = c.x;
+        m.center[1] = c.y;
+        m.center[2] = c.z;
+        // round up so float storage never shrinks the sphere
+        m.radius = std::sqrt(r2)*(1 + 1e-5) + 1e-6;
+
+        // Normal cone: average unit face normal, opened to the widest one
+        std::vector<Vertex> faceNormals;
+        faceNormals.reserve(last - first);
+        double ax = 0, ay = 0, az = 0;
+        for (size_t f = first; f < last; f++) {
+            Vertex a = positionAt(indices[3*f]);
+            Vertex b = positionAt(indices[3*f + 1]);
+            Vertex d = positionAt(indices[3*f + 2]);
+            double ux = b.x - a.x, uy = b.y - a.y, uz = b.z - a.z;
+            double vx = d.x - a.x, vy = d.y - a.y, vz = d.z - a.z;
+            double nx = uy*vz - uz*vy, ny = uz*vx - ux*vz, nz = ux*vy - uy*vx;
+            double len = std::sqrt(nx*nx + ny*ny + nz*nz);
+            if (len == 0) {
+                continue;
+            }
+            faceNormals.push_back({nx/len, ny/len, nz/len});
+            ax += nx/len;
+            ay += ny/len;
+            az += nz/len;
+        }
+        double alen = std::sqrt(ax*ax + ay*ay + az*az);
+        double minDot = -1;
+        if (alen > 0) {
+            ax /= alen;
+            ay /= alen;
+            az /= alen;
+            minDot = 1;
+            for (const Vertex& n : faceNormals) {
+                minDot = std::min(minDot, n.x*ax + n.y*ay + n.z*az);
+            }
+        }
+        if (minDot <= 0.01) {  // wider than a half space: never cull
+            m.coneAxis[0] = m.coneAxis[1] = m.coneAxis[2] = 0;
+            m.coneCutoff = 1;
+        } else {
+            m.coneAxis[0] = ax;
+            m.coneAxis[1] = ay;
+            m.coneAxis[2] = az;
+            // sin of the half angle, rounded up to stay conservative
+            m.coneCutoff = std::min(1.0, std::sqrt(1 - minDot*minDot) + 1e-5);
+        }
+
+        meshlets.push_back(m);
+        first = last;
+    }
+    return meshlets;
+}
+
+#endif
@@ -7,22 +7,51 @@
 #include <iostream>
 #include <algorithm>
 #include <sstream>
+#include <mutex>
+#include <limits>
 #include "Eigen"
 #include "Types.hpp"
 #include "Lights.hpp"
 #include "Util.hpp"
 #include "Transformations.hpp"
-#include "DiscreteDifferentialGeometry.hpp"
+#include "Rasterizer.hpp"
+#include "IndexedMesh.hpp"
+#include "MeshCache.hpp"
+#include "ChunkedMesh.hpp"
+#include "Pipeline.hpp"
+#include "Wireframe.hpp"
+#include "ThreadPool.hpp"
+
+/* LOAD_STREAMED objects keep no geometry and are piped from disk
+   straight to the rasterizer at every render, once per copy, so it suits
+   scenes with one copy per mesh; see streamShadedOBJ.
+   LOAD_COMPACT objects keep their geometry as a CompactMesh.
+   LOAD_CACHE_OPTIMIZED is LOAD_EAGER with faces and vertices reordered
+   for the post-transform vertex cache; see optimizeVertexCache.
+   LOAD_LOD also builds an LOD chain, and Scene picks a level per copy.
+   .chunks files are paged from disk under every mode. */
+enum MeshLoading {
+    LOAD_EAGER,
+    LOAD_STREAMED,
+    LOAD_COMPACT,
+    LOAD_CACHE_OPTIMIZED,
+    LOAD_LOD
+};
 
+/**
+ * Geometry loaded for one label of the objects section. An Object is
+ * immutable once built and is shared by every Instance made from it, so
+ * object copies never duplicate vertex data.
+*/
 class Object {
 public:
-    Object(std::string& fname, bool printObj = true) {
-        vertices.emplace_back();  // dummy vertex for 1-indexing
-        normals.emplace_back();
-
-        std::ifstream file{fname};
-        std::string currLine;
-
+    /** @param weldEpsilon Vertices this close are welded at load time;
+     *                     see repairMesh. Ignored for .chunks files and
+     *                     LOAD_STREAMED. */
+    Object(std::string& fname, bool printObj = true,
+           MeshLoading loading_ = MeshLoading::LOAD_EAGER, double weldEpsilon = 0)
+        : sourceFname{fname}, loading{loading_}
+    {
         if (printObj) {
             // print header
             std::cout << ". loc: " << fname.find(".") << std::endl;
@@ -30,430 +59,460 @@ public:
                       << std::endl << std::endl;
         }
 
-        std::getline(file, currLine);
-
-        while (file) {
-            std::string hdr = currLine.substr(0, currLine.find(' '));
-            if (hdr == "v") {
-                double buff[3];
-                std::string s;
-                assert(3 == parse_parameter_str(currLine,
-                                                s,
-                                                buff,
-                                                3));
-                Vertex v = {buff[0], buff[1], buff[2]};
-                vertices.push_back(v);
-            } else if (hdr == "vn") {
-                double buff[3];
-                std::string s;
-                assert(3 == parse_parameter_str(currLine,
-                                                s,
-                                                buff,
-                                                3));
-                Vertex n = {buff[0], buff[1], buff[2]};
-                normals.push_back(n);
-            } else if (hdr == "f") {
-                int vBuff[3];
-                int nBuff[3];
-                std::string lbl;
-                try {
-                  parseStrTwoBuff(currLine, vBuff, nBuff);
-                } catch (std::invalid_argument& e) {
-                  parse_parameter_str(currLine, lbl, vBuff, 3);
-                }
-                Face f = {{vBuff[0], vBuff[1], vBuff[2]},
-                          {nBuff[0], nBuff[1], nBuff[2]}};
-                faces.push_back(f);
-            } else {
-                std::cout << "ERROR: parsing .obj unknown hdr "
-                          << hdr << std::endl;
-            }
-
-            std::getline(file, currLine);
+        if (isChunkedMeshFile(fname)) {
+            // out-of-core: geometry stays on disk and is streamed by chunk,
+            // whatever the loading mode
+            chunked = std::make_shared<ChunkedMesh>(fname);
+        } else if (loading == MeshLoading::LOAD_STREAMED) {
+            // nothing is kept
+        } else if (loading == MeshLoading::LOAD_COMPACT) {
+            compact = CompactMeshCache::shared().get(fname, weldEpsilon);
+        } else if (loading == MeshLoading::LOAD_CACHE_OPTIMIZED) {
+            cacheOptimized = CacheOptimizedMeshCache::shared().get(fname, weldEpsilon);
+            indexed = cacheOptimized;
+        } else if (loading == MeshLoading::LOAD_LOD) {
+            lod = LODMeshCache::shared().get(fname, weldEpsilon);
+            indexed = std::shared_ptr<const IndexedMesh>(lod, &lod->levels[0]);
+        } else {
+            indexed = IndexedMeshCache::shared().get(fname, weldEpsilon);
         }
+        computeBounds();
+
         if (printObj) {
             std::cout << std::endl;
         }
-
-        if (normals.size() == 1) {
-            computeVertexNormals(normals, vertices, faces);
-        }
     }
 
-    Object(std::string& fname, std::string& label_, bool printObj = true)
-        : Object(fname, printObj)
+    Object(std::string& fname, std::string& label_, bool printObj = true,
+           MeshLoading loading_ = MeshLoading::LOAD_EAGER, double weldEpsilon = 0)
+        : Object(fname, printObj, loading_, weldEpsilon)
     {
         label = label_;
     }
 
-    Object(Object& other) {
-        vertices = other.vertices;
-        normals = other.normals;
-        faces = other.faces;
-        label = other.label + "_copy" + std::to_string(other.getAndIncNumCopies());
-    }
+    Object(const Object&) = delete;
+    Object& operator=(const Object&) = delete;
 
     /**
-     * TODO rename to renderWireframe
+     * Draws every triangle's three edges into 'screenCoords', one thread.
+     * Scene::wireframePPM uses renderWireframe.
     */
     void fillScreenCoords(std::vector<std::vector<bool>>& screenCoords,
-                          size_t xres, size_t yres) {  // TODO OVERLOAD with argument RENDER_MODE, buffer_grid
-        for (Face face : faces) {
-            Vertex v1 = vertices[face.v.i1];
-            int32_t v1_x = (int32_t) (((v1.x - (-1)) / (1 - (-1))) * xres);
-            int32_t v1_y = (int32_t) (((v1.y - (-1)) / (1 - (-1))) * yres);
-            v1_x = std::min(std::max(0, v1_x), (int32_t) xres-1);
-            v1_y = std::min(std::max(0, v1_y), (int32_t) yres-1);
-
-            Vertex v2 = vertices[face.v.i2];
-            int32_t v2_x = (int32_t) (((v2.x - (-1)) / (1 - (-1))) * xres);
-            int32_t v2_y = (int32_t) (((v2.y - (-1)) / (1 - (-1))) * yres);
-            v2_x = std::min(std::max(0, v2_x), (int32_t) xres-1);
-            v2_y = std::min(std::max(0, v2_y), (int32_t) yres-1);
-
-            Vertex v3 = vertices[face.v.i3];
-            int32_t v3_x = (int32_t) (((v3.x - (-1)) / (1 - (-1))) * xres);
-            int32_t v3_y = (int32_t) (((v3.y - (-1)) / (1 - (-1))) * yres);
-            v3_x = std::min(std::max(0, v3_x), (int32_t) xres-1);
-            v3_y = std::min(std::max(0, v3_y), (int32_t) yres-1);
-
-            drawLine(v1_y, v1_x, v2_y, v2_x, screenCoords);
-            drawLine(v1_y, v1_x, v3_y, v3_x, screenCoords);
-            drawLine(v2_y, v2_x, v3_y, v3_x, screenCoords);
-        }
-    }
-
-    void addTransformation(Eigen::Matrix4d& t) {
-        transformation = t*transformation;
-    }
-
-    void addNormalTransformation(Eigen::Matrix4d& t) {
-        normalTrans = t*normalTrans;
+                          size_t xres, size_t yres) const {
+        auto plot = [&](int32_t a, int32_t b) { screenCoords[a][b] = true; };
+        forEachTriangle([&](const Vertex* v, const Vertex*) {
+            Wireframe::drawEdge(v[0], v[1], xres, yres, plot);
+            Wireframe::drawEdge(v[0], v[2], xres, yres, plot);
+            Wireframe::drawEdge(v[1], v[2], xres, yres, plot);
+        });
     }
 
     /**
-     * Applies `transformation` to every vertex in `vertices`, in-place
+     * Draws the wireframe into 'plane', covering the same pixels as
+     * fillScreenCoords. Indexed layouts draw each distinct edge once, from
+     * a list built on first use, in parallel on ThreadPool::shared();
+     * out-of-core objects fall back to drawing every triangle's edges.
     */
-    void applyTransformation() {
-        for (size_t i = 1; i < vertices.size(); i++) {
-            // World Space
-            Eigen::Vector4d V_ws;
-            V_ws << vertices[i].x, vertices[i].y, vertices[i].z, 1;
-
-            // World space --> homogeneous NDC
-            Eigen::Vector4d V_t = transformation*V_ws;
-            /*
-            double x_hndc = V_hndc(0);
-            double y_hndc = V_hndc(1);
-            double z_hndc = V_hndc(2);
-            double w_hndc = V_hndc(3);
-            */
-            assert(V_t(3) == 1);
-
-            // homogeneous NDC --> cartesian NDC
-            // Eigen::Vector4d V_cndc;
-            // V_cndc << x_hndc/w_hndc, y_hndc/w_hndc, z_hndc/w_hndc, 1;
-
-            vertices[i] = {V_t(0), V_t(1), V_t(2)};
+    void renderWireframe(Bitplane& plane, size_t xres, size_t yres) const {
+        if (!indexed && !compact) {
+            Bitplane::Writer writer{plane};
+            auto plot = [&](int32_t a, int32_t b) { writer.set(a, b); };
+            forEachTriangle([&](const Vertex* v, const Vertex*) {
+                Wireframe::drawEdge(v[0], v[1], xres, yres, plot);
+                Wireframe::drawEdge(v[0], v[2], xres, yres, plot);
+                Wireframe::drawEdge(v[1], v[2], xres, yres, plot);
+            });
+            return;
         }
+        std::call_once(edgesOnce, [this] {
+            edges = indexed ? uniqueEdges(indexed->indices, indexed->vertices.size())
+                            : uniqueEdges(compact->indices, compact->numVertices());
+        });
+        auto positionAt = [&](uint32_t i) {
+            return indexed ? indexed->vertices[i].position() : compact->position(i);
+        };
+        const size_t GRAIN = 1 << 12;
+        ThreadPool::shared().parallelFor(edges.size() / 2, GRAIN, [&](size_t lo, size_t hi) {
+            Bitplane::Writer writer{plane};
+            auto plot = [&](int32_t a, int32_t b) { writer.set(a, b); };
+            for (size_t e = lo; e < hi; e++) {
+                Wireframe::drawEdge(positionAt(edges[2*e]), positionAt(edges[2*e + 1]),
+                                    xres, yres, plot);
+            }
+        });
     }
 
-    void applyNormalTransformation() {
-        Eigen::Matrix4d inv = normalTrans.inverse();
-        Eigen::Matrix4d T = inv.transpose();
-
-        for (size_t i = 1; i < normals.size(); i++) {
-            Eigen::Vector4d N;
-            N << normals[i].x, normals[i].y, normals[i].z, 1;
-
-            Eigen::Vector4d N_t = T*N;
-            // N_t.normalize();
-
-            normals[i] = {N_t(0), N_t(1), N_t(2)};
+    /**
+     * Rasterizes the object with material 'm' into 'screenGrid'. Out-of-core
+     * objects stream only the chunks whose bounds intersect the view frustum,
+     * paging them through ChunkCache::shared(). LOAD_STREAMED objects are
+     * parsed and rasterized concurrently by streamShadedOBJ. 'lodLevel'
+     * selects a level of the LOD chain, if the object has one. Triangles
+     * set in 'hiddenTriangles' are skipped; it is indexed like the indices
+     * of the IndexedMesh drawn, and ignored for other layouts.
+    */
+    void renderShadedObj(const Material& m,
+                         std::vector<std::vector<Color>>& screenGrid,
+                         size_t xres, size_t yres, ShadingAlgo alg,
+                         std::vector<PointLight>& lights, Vertex& cameraPos,
+                         Eigen::Matrix4d& worldToHomoNDC,
+                         std::vector<std::vector<double>>& minDepth,
+                         size_t lodLevel = 0,
+                         const std::vector<char>* hiddenTriangles = nullptr) const {
+        if (loading == MeshLoading::LOAD_STREAMED && !chunked) {
+            streamShadedOBJ(sourceFname, m, alg, lights, cameraPos,
+                            worldToHomoNDC, screenGrid, xres, yres, minDepth);
+            return;
+        }
+        if (indexed) {
+            const IndexedMesh* mesh = indexed.get();
+            if (lod) {
+                mesh = &lod->levels[std::min(lodLevel, lod->levels.size() - 1)];
+            }
+            renderShadedMesh(*mesh, m, screenGrid, xres, yres, alg, lights,
+                             cameraPos, worldToHomoNDC, minDepth, hiddenTriangles);
+            return;
+        }
+        if (compact) {
+            renderShadedIndexed(compact->numVertices(),
+                                [&](uint32_t i, Vertex& v, Vertex& n) {
+                                    v = compact->position(i);
+                                    n = compact->normal(i);
+                                },
+                                compact->indices, compact->meshlets,
+                                m, screenGrid, xres, yres,
+                                alg, lights, cameraPos, worldToHomoNDC,
+                                minDepth);
+            return;
+        }
+        if (chunked) {
+            for (size_t i = 0; i < chunked->size(); i++) {
+                const ChunkRecord& r = chunked->record(i);
+                if (!boxInFrustum(r.min, r.max, worldToHomoNDC)) {
+                    continue;
+                }
+                ChunkView chunk = ChunkCache::shared().acquire(*chunked, i);
+                renderShadedFaces(chunk.vertices, chunk.normals,
+                                  chunk.faces, chunk.numFaces, m,
+                                  screenGrid, xres, yres, alg, lights,
+                                  cameraPos, worldToHomoNDC, minDepth);
+            }
         }
     }
 
-    void setMaterialProperties(Color& a, Color& d,
-                               Color& s, double sns) {
-        ambient = a;
-        diffuse = d;
-        specular = s;
-        shininess = sns;
+    /** @brief Rasterizes 'mesh', which need not be this object's, the way
+     *         renderShadedObj draws an eagerly loaded object. */
+    void renderShadedMesh(const IndexedMesh& mesh, const Material& m,
+                          std::vector<std::vector<Color>>& screenGrid,
+                          size_t xres, size_t yres, ShadingAlgo alg,
+                          std::vector<PointLight>& lights, Vertex& cameraPos,
+                          Eigen::Matrix4d& worldToHomoNDC,
+                          std::vector<std::vector<double>>& minDepth,
+                          const std::vector<char>* hiddenTriangles = nullptr) const {
+        const std::vector<IndexedVertex>& verts = mesh.vertices;
+        renderShadedIndexed(verts.size(),
+                            [&](uint32_t i, Vertex& v, Vertex& n) {
+                                v = verts[i].position();
+                                n = verts[i].normal();
+                            },
+                            mesh.indices, mesh.meshlets,
+                            m, screenGrid, xres, yres,
+                            alg, lights, cameraPos, worldToHomoNDC,
+                            minDepth, hiddenTriangles);
     }
 
-    size_t getAndIncNumCopies() {
-        return ++numCopies;
+    const std::string& getLabel() const {
+        return label;
     }
 
-    void renderShadedObj(std::vector<std::vector<Color>>& screenGrid,
-                         size_t xres, size_t yres, ShadingAlgo alg,
-                         std::vector<PointLight>& lights, Vertex& cameraPos,
-                         Eigen::Matrix4d& worldToHomoNDC,
-                         std::vector<std::vector<double>>& minDepth) {
-        for (Face f : faces) {
-            Vertex v1 = vertices[f.v.i1];
-            Vertex v2 = vertices[f.v.i2];
-            Vertex v3 = vertices[f.v.i3];
-            Vertex n1 = normals[f.n.i1];
-            Vertex n2 = normals[f.n.i2];
-            Vertex n3 = normals[f.n.i3];
-
-            Color c1 = LightingModel(v1, n1, diffuse, ambient,
-                                     specular, shininess, lights,
-                                     cameraPos);
-            Color c2 = LightingModel(v2, n2, diffuse, ambient,
-                                     specular, shininess, lights,
-                                     cameraPos);
-            Color c3 = LightingModel(v3, n3, diffuse, ambient,
-                                     specular, shininess, lights,
-                                     cameraPos);
-
-            Vertex v1_ndc = worldToNDC(worldToHomoNDC, v1);
-            Vertex v2_ndc = worldToNDC(worldToHomoNDC, v2);
-            Vertex v3_ndc = worldToNDC(worldToHomoNDC, v3);
-
-            if (isBackFacing(v1_ndc, v2_ndc, v3_ndc)) {
-                continue;
-            }
+    /** Views of the IndexedMesh that eagerly loaded objects render from.
+        Other layouts have none, so these are empty; use forEachTriangle to
+        read any resident layout. */
+    ConstView<IndexedVertex> getVertices() const {
+        return indexed ? ConstView<IndexedVertex>{indexed->vertices}
+                       : ConstView<IndexedVertex>{};
+    }
 
-            std::pair<int, int> v1_sc = NDCtoScreen(v1_ndc, xres, yres);
-            std::pair<int, int> v2_sc = NDCtoScreen(v2_ndc, xres, yres);
-            std::pair<int, int> v3_sc = NDCtoScreen(v3_ndc, xres, yres);
-
-            size_t x_min = std::min({v1_sc.first, v2_sc.first, v3_sc.first});
-            size_t y_min = std::min({v1_sc.second, v2_sc.second, v3_sc.second});
-            size_t x_max = std::max({v1_sc.first, v2_sc.first, v3_sc.first});
-            size_t y_max = std::max({v1_sc.second, v2_sc.second, v3_sc.second});
-
-            for (size_t x = x_min; x <= x_max; x++) {
-                for (size_t y = y_min; y <= y_max; y++) {
-                    double alpha = f_ij(x, y,
-                                        v2_sc.first, v2_sc.second,
-                                        v3_sc.first, v3_sc.second) /
-                                   f_ij(v1_sc.first, v1_sc.second,
-                                        v2_sc.first, v2_sc.second,
-                                        v3_sc.first, v3_sc.second);
-                    double beta = f_ij(x, y,
-                                       v1_sc.first, v1_sc.second,
-                                       v3_sc.first, v3_sc.second) /
-                                   f_ij(v2_sc.first, v2_sc.second,
-                                        v1_sc.first, v1_sc.second,
-                                        v3_sc.first, v3_sc.second);
-                    double gamma = f_ij(x, y,
-                                        v1_sc.first, v1_sc.second,
-                                        v2_sc.first, v2_sc.second) /
-                                   f_ij(v3_sc.first, v3_sc.second,
-                                        v1_sc.first, v1_sc.second,
-                                        v2_sc.first, v2_sc.second);
-
-                    if (0 <= alpha && alpha <= 1 &&
-                        0 <= beta && beta <= 1 &&
-                        0 <= gamma && gamma <= 1) {
-                        Vertex interp_ndc = {alpha*v1_ndc.x + beta*v2_ndc.x + gamma*v3_ndc.x,
-                                             alpha*v1_ndc.y + beta*v2_ndc.y + gamma*v3_ndc.y,
-                                             alpha*v1_ndc.z + beta*v2_ndc.z + gamma*v3_ndc.z};
-                        if (inNDCcube(interp_ndc) &&
-                            (interp_ndc.z < minDepth[x][y])) {
-                            minDepth[x][y] = interp_ndc.z;
-                            switch (alg) {
-                                case ShadingAlgo::GOURAUD: {
-                                    double r = alpha*c1.r + beta*c2.r + gamma*c3.r;
-                                    double g = alpha*c1.g + beta*c2.g + gamma*c3.g;
-                                    double b = alpha*c1.b + beta*c2.b + gamma*c3.b;
-                                    screenGrid[x][y] = {r, g, b};
-                                    break;
-                                }
-                                case ShadingAlgo::PHONG: {
-                                    double vx = alpha*v1.x + beta*v2.x + gamma*v3.x;
-                                    double vy = alpha*v1.y + beta*v2.y + gamma*v3.y;
-                                    double vz = alpha*v1.z + beta*v2.z + gamma*v3.z;
-                                    Vertex v_interp = {vx, vy, vz};
-
-                                    double nx = alpha*n1.x + beta*n2.x + gamma*n3.x;
-                                    double ny = alpha*n1.y + beta*n2.y + gamma*n3.y;
-                                    double nz = alpha*n1.z + beta*n2.z + gamma*n3.z;
-                                    double norm = std::sqrt(nx*nx + ny*ny + nz*nz);
-
-                                    Vertex n_interp = {nx/norm, ny/norm, nz/norm};
-                                    screenGrid[x][y] = LightingModel(v_interp, n_interp,
-                                                                     diffuse, ambient,
-                                                                     specular, shininess,
-                                                                     lights, cameraPos);
-                                    break;
-                                }
-                                default:
-                                    assert(false);
-                            }
-                        }
-                    }
-                }
-            }
-        }
+    ConstView<uint32_t> getIndices() const {
+        return indexed ? ConstView<uint32_t>{indexed->indices}
+                       : ConstView<uint32_t>{};
     }
 
-    std::vector<Vertex> getVertices() {
-        return vertices;
+    std::shared_ptr<const IndexedMesh> getIndexedMesh() const {
+        return indexed;
     }
 
-    std::vector<Vertex> getNormals() {
-        return normals;
+    std::shared_ptr<const CompactMesh> getCompactMesh() const {
+        return compact;
     }
 
-    std::vector<Face> getFaces() {
-        return faces;
+    /** @return false if the object keeps no geometry (LOAD_STREAMED),
+     *          else a sphere around all of it. */
+    bool getBoundingSphere(Vertex& center, double& radius) const {
+        center = boundsCenter;
+        radius = boundsRadius;
+        return hasBounds;
     }
 
-    void recordTransformation(Type tt, float* params) {
-        TransformationRecord tr;
-        tr.tt = tt;
-        tr.params[0] = params[0];
-        tr.params[1] = params[1];
-        tr.params[2] = params[2];
-        tr.params[3] = params[3];
-        transSeq.push_back(tr);
+    /** @return The LOD chain of a LOAD_LOD object, else null. Level 0 is
+     *          also what getIndexedMesh() returns. */
+    std::shared_ptr<const LODMesh> getLODMesh() const {
+        return lod;
     }
 
-    Color ambient;
-    Color diffuse;
-    Color specular;
-    double shininess;
-    std::vector<TransformationRecord> transSeq;
+    /** @return false unless the object was loaded LOAD_CACHE_OPTIMIZED;
+     *          else 'stats' holds its ACMR before and after reordering. */
+    bool getVertexCacheStats(VertexCacheStats& stats) const {
+        if (!cacheOptimized) {
+            return false;
+        }
+        stats = cacheOptimized->stats;
+        return true;
+    }
 
-private:
-    // TODO: move into Wireframe file
-    void drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1,
-                  std::vector<std::vector<bool>>& screenCoords) {
-        int32_t delta_x = x1 - x0;
-        int32_t delta_y = y1 - y0;
-
-        int32_t i_left, j_left, i_right, j_right;  // implementation: i_left <= i_right
-
-        // if slope > 1 ==> flip x and y to make 0<=slope<=1
-        bool flip_x_and_y = std::abs(delta_x) < std::abs(delta_y);
-        if (flip_x_and_y) {
-            if (delta_y >= 0) {
-                i_left = y0;
-                j_left = x0;
-                i_right = y1;
-                j_right = x1;
-            } else {
-                i_left = y1;
-                j_left = x1;
-                i_right = y0;
-                j_right = x0;
+    /**
+     * Calls 'fn(const Vertex* v, const Vertex* n)' with the three corner
+     * positions and normals of every triangle, whatever the layout. Out-of-
+     * core objects are paged in chunk by chunk; streamed objects keep no
+     * geometry and yield nothing.
+    */
+    template <typename F>
+    void forEachTriangle(F&& fn) const {
+        Vertex v[3], n[3];
+        if (indexed) {
+            const std::vector<uint32_t>& idx = indexed->indices;
+            for (size_t i = 0; i + 2 < idx.size(); i += 3) {
+                for (int k = 0; k < 3; k++) {
+                    v[k] = indexed->vertices[idx[i + k]].position();
+                    n[k] = indexed->vertices[idx[i + k]].normal();
+                }
+                fn(v, n);
             }
-        } else {
-            if (delta_x >= 0) {
-                i_left = x0;
-                j_left = y0;
-                i_right = x1;
-                j_right = y1;
-            } else {
-                i_left = x1;
-                j_left = y1;
-                i_right = x0;
-                j_right = y0;
+            return;
+        }
+        if (compact) {
+            const std::vector<uint32_t>& idx = compact->indices;
+            for (size_t i = 0; i + 2 < idx.size(); i += 3) {
+                for (int k = 0; k < 3; k++) {
+                    v[k] = compact->position(idx[i + k]);
+                    n[k] = compact->normal(idx[i + k]);
+                }
+                fn(v, n);
             }
+            return;
         }
-
-        if (j_left <= j_right) {
-            rasterizeLinePosSlope(i_left, j_left, i_right, j_right, screenCoords, flip_x_and_y);
-        } else {
-            rasterizeLineNegSlope(i_left, j_left, i_right, j_right, screenCoords, flip_x_and_y);
+        if (chunked) {
+            for (size_t i = 0; i < chunked->size(); i++) {
+                ChunkView chunk = ChunkCache::shared().acquire(*chunked, i);
+                for (size_t j = 0; j < chunk.numFaces; j++) {
+                    const Face& f = chunk.faces[j];
+                    v[0] = chunk.vertices[f.v.i1];
+                    v[1] = chunk.vertices[f.v.i2];
+                    v[2] = chunk.vertices[f.v.i3];
+                    n[0] = chunk.normals[f.n.i1];
+                    n[1] = chunk.normals[f.n.i2];
+                    n[2] = chunk.normals[f.n.i3];
+                    fn(v, n);
+                }
+            }
         }
+    }
 
+    /** @brief Explicit deep copy of the geometry in the 1-indexed Mesh
+     *         layout. Out-of-core objects come out unwelded. */
+    Mesh copyMesh() const {
+        if (indexed) {
+            return expandIndexedMesh(*indexed);
+        }
+        if (compact) {
+            return expandCompactMesh(*compact);
+        }
+        Mesh mesh;
+        mesh.vertices.emplace_back();  // dummy vertex for 1-indexing
+        mesh.normals.emplace_back();
+        forEachTriangle([&](const Vertex* v, const Vertex* n) {
+            int first = mesh.vertices.size();
+            for (int k = 0; k < 3; k++) {
+                mesh.vertices.push_back(v[k]);
+                mesh.normals.push_back(n[k]);
+            }
+            Face::IdxTriple idx = {first, first + 1, first + 2};
+            mesh.faces.push_back({idx, idx});
+        });
+        return mesh;
     }
 
-    void rasterizeLineNegSlope(int32_t i0, int32_t j0, int32_t i1, int32_t j1,
-                               std::vector<std::vector<bool>>& screenCoords,
-                               bool flipped_x_and_y) {
-        int32_t eps = 0;
-        int32_t y = j0;
-        int32_t neg_delta_x = i0 - i1;
-        assert(neg_delta_x <= 0);
-        int32_t delta_y = j1 - j0;
-        assert(delta_y < 0);
-
-        // special case
-        if (i0 == i1) {
-            for (int32_t y = j0; y <= j1; y++) {
-                // TODO: flip y to y_max - y
-                if (flipped_x_and_y) {
-                    screenCoords[i0][y] = true;
-                } else {
-                    screenCoords[y][i0] = true;
-                }
+private:
+    /* Bounding sphere around the bounding box of the resident vertices, or
+       of the chunk records, so out-of-core objects are not paged in. */
+    void computeBounds() {
+        const double MAX = std::numeric_limits<double>::max();
+        Vertex lo = {MAX, MAX, MAX}, hi = {-MAX, -MAX, -MAX};
+        auto addPoint = [&](const Vertex& p) {
+            hasBounds = true;
+            lo = {std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z)};
+            hi = {std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z)};
+        };
+        if (indexed) {
+            for (const IndexedVertex& v : indexed->vertices) {
+                addPoint(v.position());
             }
+        } else if (compact) {
+            for (uint32_t i = 0; i < compact->numVertices(); i++) {
+                addPoint(compact->position(i));
+            }
+        } else if (chunked) {
+            for (size_t i = 0; i < chunked->size(); i++) {
+                addPoint(chunked->record(i).min);
+                addPoint(chunked->record(i).max);
+            }
+        }
+        if (!hasBounds) {
             return;
         }
+        boundsCenter = {(lo.x + hi.x)/2, (lo.y + hi.y)/2, (lo.z + hi.z)/2};
+        double dx = hi.x - boundsCenter.x;
+        double dy = hi.y - boundsCenter.y;
+        double dz = hi.z - boundsCenter.z;
+        boundsRadius = std::sqrt(dx*dx + dy*dy + dz*dz);
+    }
 
-        for (int32_t x = i0; x <= i1; x++) {
-            if (flipped_x_and_y) {
-                screenCoords[x][y] = true;
-            } else {
-                screenCoords[y][x] = true;
-            }
-
-            int32_t val = (eps + delta_y) << 1;
-            if (val < neg_delta_x) {
-                eps += delta_y - neg_delta_x;  // delta_y + delta_x
-                y--;
-            } else {
-                eps += delta_y;
+    void renderShadedFaces(const Vertex* verts, const Vertex* norms,
+                           const Face* fcs, size_t numFaces,
+                           const Material& m,
+                           std::vector<std::vector<Color>>& screenGrid,
+                           size_t xres, size_t yres, ShadingAlgo alg,
+                           std::vector<PointLight>& lights, Vertex& cameraPos,
+                           Eigen::Matrix4d& worldToHomoNDC,
+                           std::vector<std::vector<double>>& minDepth) const {
+        for (size_t i = 0; i < numFaces; i++) {
+            const Face& f = fcs[i];
+            Vertex v[3] = {verts[f.v.i1], verts[f.v.i2], verts[f.v.i3]};
+            Vertex n[3] = {norms[f.n.i1], norms[f.n.i2], norms[f.n.i3]};
+
+            ShadedVertex sv[3];
+            if (!shadeTriangle(v, n, m, alg, lights, cameraPos,
+                               worldToHomoNDC, sv)) {
+                continue;
             }
+            rasterizeTriangle(sv, m, alg, lights, cameraPos,
+                              screenGrid, xres, yres, minDepth);
         }
     }
 
-    void rasterizeLinePosSlope(int32_t i0, int32_t j0, int32_t i1, int32_t j1,
-                               std::vector<std::vector<bool>>& screenCoords,
-                               bool flipped_x_and_y) {
-        int32_t eps = 0;
-        int32_t y = j0;
-        int32_t delta_x = i1 - i0;
-        assert(delta_x >= 0);
-        int32_t delta_y = j1 - j0;
-        assert(delta_y >= 0);  // positive slope
-
-        // special case
-        if (i0 == i1) {
-            for (int32_t y = j0; y <= j1; y++) {
-                // TODO: flip y to y_max - y
-                if (flipped_x_and_y) {
-                    screenCoords[i0][y] = true;
-                } else {
-                    screenCoords[y][i0] = true;
+    /**
+     * Draws the triangles of 'indices', skipping whole meshlets that face
+     * away from the camera or lie outside the view frustum. Vertices are
+     * projected when a surviving triangle first uses them and lit when a
+     * front-facing one does, at most once each. 'vertexAt(i, v, n)' reads
+     * position and normal i of the layout being drawn. Triangles set in
+     * 'hidden', if given, are not drawn.
+    */
+    template <typename VertexAt>
+    void renderShadedIndexed(size_t numVertices, VertexAt&& vertexAt,
+                             const std::vector<uint32_t>& indices,
+                             const std::vector<Meshlet>& meshlets,
+                             const Material& m,
+                             std::vector<std::vector<Color>>& screenGrid,
+                             size_t xres, size_t yres, ShadingAlgo alg,
+                             std::vector<PointLight>& lights, Vertex& cameraPos,
+                             Eigen::Matrix4d& worldToHomoNDC,
+                             std::vector<std::vector<double>>& minDepth,
+                             const std::vector<char>* hidden = nullptr) const {
+        IndexedScratch& scratch = IndexedScratch::forThread(numVertices);
+        std::vector<ShadedVertex>& shaded = scratch.shaded;
+        std::vector<uint32_t>& projected = scratch.projected;
+        std::vector<uint32_t>& lit = scratch.lit;
+        const uint32_t now = scratch.generation;
+
+        auto drawTriangles = [&](size_t first, size_t count) {
+            for (size_t t = first; t < first + count; t++) {
+                if (hidden && (*hidden)[t]) {
+                    continue;
+                }
+                const uint32_t* tri = &indices[3*t];
+                for (int k = 0; k < 3; k++) {
+                    if (projected[tri[k]] != now) {
+                        Vertex v, n;
+                        vertexAt(tri[k], v, n);
+                        shaded[tri[k]] = projectVertex(v, n, worldToHomoNDC);
+                        projected[tri[k]] = now;
+                    }
                 }
+                if (isBackFacing(shaded[tri[0]].ndc, shaded[tri[1]].ndc,
+                                 shaded[tri[2]].ndc)) {
+                    continue;
+                }
+                for (int k = 0; k < 3; k++) {
+                    if (lit[tri[k]] != now) {
+                        lightVertex(shaded[tri[k]], m, alg, lights, cameraPos);
+                        lit[tri[k]] = now;
+                    }
+                }
+                ShadedVertex sv[3] = {shaded[tri[0]], shaded[tri[1]], shaded[tri[2]]};
+                rasterizeTriangle(sv, m, alg, lights, cameraPos,
+                                  screenGrid, xres, yres, minDepth);
             }
+        };
+
+        if (meshlets.empty()) {
+            drawTriangles(0, indices.size() / 3);
             return;
         }
-
-        for (int32_t x = i0; x <= i1; x++) {
-            if (flipped_x_and_y) {
-                screenCoords[x][y] = true;
-            } else {
-                screenCoords[y][x] = true;
+        for (const Meshlet& ml : meshlets) {
+            if (ml.isBackFacing(cameraPos)) {
+                continue;
             }
-
-            int32_t val = (eps + delta_y) << 1;
-            if (val < delta_x) {
-                eps += delta_y;
-            } else {
-                eps += (delta_y - delta_x);
-                y++;
+            Vertex lo = {ml.center[0] - ml.radius, ml.center[1] - ml.radius,
+                         ml.center[2] - ml.radius};
+            Vertex hi = {ml.center[0] + ml.radius, ml.center[1] + ml.radius,
+                         ml.center[2] + ml.radius};
+            if (!boxInFrustum(lo, hi, worldToHomoNDC)) {
+                continue;
             }
+            drawTriangles(ml.firstTriangle, ml.numTriangles);
         }
     }
 
-    /** Product of all transformations:  geometric transformations, world-to-camera projection,
-        perspective projection. */
-    Eigen::Matrix4d transformation{Eigen::Matrix4d::Identity()};
-    Eigen::Matrix4d normalTrans{Eigen::Matrix4d::Identity()};
+    /* Per-vertex state of renderShadedIndexed, kept per thread and grown
+       to the largest mesh drawn, so drawing a copy does not allocate. A
+       vertex is projected or lit in the current call if its stamp equals
+       'generation', which each call advances instead of clearing. */
+    struct IndexedScratch {
+        std::vector<ShadedVertex> shaded;
+        std::vector<uint32_t> projected, lit;
+        uint32_t generation{0};
+
+        static IndexedScratch& forThread(size_t numVertices) {
+            thread_local IndexedScratch scratch;
+            if (scratch.shaded.size() < numVertices) {
+                scratch.shaded.resize(numVertices);
+                scratch.projected.resize(numVertices, 0);
+                scratch.lit.resize(numVertices, 0);
+            }
+            if (++scratch.generation == 0) {
+                // wrapped: stamps from 2^32 calls ago would match again
+                std::fill(scratch.projected.begin(), scratch.projected.end(), 0);
+                std::fill(scratch.lit.begin(), scratch.lit.end(), 0);
+                scratch.generation = 1;
+            }
+            return scratch;
+        }
+    };
 
     std::string label;
-    size_t numCopies{0};
-    std::vector<Vertex> vertices;
-    std::vector<Face> faces;
-    std::vector<Vertex> normals;
+    std::shared_ptr<const IndexedMesh> indexed;  // set for LOAD_EAGER .obj files
+    std::shared_ptr<const LODMesh> lod;  // set for LOAD_LOD; 'indexed' is its level 0
+    std::shared_ptr<const CacheOptimizedMesh> cacheOptimized;  // LOAD_CACHE_OPTIMIZED; = 'indexed'
+    std::shared_ptr<const CompactMesh> compact;  // set for LOAD_COMPACT
+    std::shared_ptr<ChunkedMesh> chunked;  // set for out-of-core objects
+    mutable std::once_flag edgesOnce;
+    mutable std::vector<uint32_t> edges;  // distinct edges, 2 entries each; see renderWireframe
+    std::string sourceFname;
+    MeshLoading loading;
+    bool hasBounds{false};
+    Vertex boundsCenter{0, 0, 0};
+    double boundsRadius{0};
 };
 
 #endif
@@ -1,8 +1,15 @@
 #ifndef PARSER_HPP
 #define PARSER_HPP
 
+#include <cctype>
+#include <exception>
+#include <future>
+#include <iostream>
+#include <string_view>
 #include <unordered_map>
 #include "Objects.hpp"
+#include "Instance.hpp"
+#include "ThreadPool.hpp"
 #include "Transformations.hpp"
 
 enum ParsingStage : size_t {
@@ -18,69 +25,116 @@ enum ParsingStage : size_t {
  *  - camera
  *  - labelToObj
  *  - objectCopies
+ *
+ * Every line is read into the same buffer and tokenized through
+ * std::string_view, so the camera, lights and object copies sections do
+ * no per-line heap allocation. On malformed input, reports the offending
+ * line number to stderr and returns false.
+ *
+ * Meshes in the objects section are loaded on ThreadPool::shared() while
+ * parsing continues; each one is joined the first time a copy uses it, and
+ * any left over are joined before returning. A mesh that fails to load is
+ * reported against the line that declared it. With LOAD_STREAMED, meshes
+ * are not read at all until they are rendered.
  */
 bool parseDescription(const std::string& fname,
                       std::unordered_map<std::string, std::shared_ptr<Object>>& labelToObj,
-                      std::vector<std::shared_ptr<Object>>& objectCopies,
+                      std::vector<Instance>& objectCopies,
                       std::vector<PointLight>& lights, Camera& camera,
-                      Eigen::Matrix4d& worldToHomoNDC)
+                      Eigen::Matrix4d& worldToHomoNDC,
+                      MeshLoading loading = MeshLoading::LOAD_EAGER,
+                      double weldEpsilon = 0)
 {
     ParsingStage stage{ParsingStage::CAMERA};
     std::ifstream file{fname};
     std::string line;
-    
+    std::string labelBuff;  // reused for label lookups
+    struct PendingObject {
+        std::shared_future<std::shared_ptr<Object>> object;
+        size_t lineNo;  // of the line that declared it
+    };
+    std::unordered_map<std::string, PendingObject> pendingObjs;
+    size_t lineNo = 0;
+    auto error = [&](const char* msg) {
+        return reportParseError(fname, lineNo, msg);
+    };
+    // Waits for a mesh load; a failure is reported against its declaration
+    auto join = [&](const std::string& label, PendingObject& pending) {
+        try {
+            labelToObj.emplace(label, pending.object.get());
+            return true;
+        } catch (const std::exception& e) {
+            std::string msg = "cannot load object: " + std::string{e.what()};
+            return reportParseError(fname, pending.lineNo, msg.c_str());
+        }
+    };
+
+    if (!file) {
+        return error("cannot open scene description");
+    }
+
     Eigen::Matrix4d normalTrans;
-    Color ambient, diffuse, specular;
-    double shininess;
+    Color ambient{}, diffuse{}, specular{};
+    double shininess{0};
 
     std::getline(file, line);
-    assert(line == "camera:");  // expected first line in file
+    lineNo++;
+    std::string_view first{line};
+    std::string_view token;
+    if (!next_token(first, token) || token != "camera:") {
+        return error("expected 'camera:'");
+    }
 
     std::getline(file, line);
+    lineNo++;
     while (file) {
+        std::string_view lineView{line};
+        while (!lineView.empty() && std::isspace((unsigned char) lineView.back())) {
+            lineView.remove_suffix(1);  // tolerate '\r' and trailing blanks
+        }
+
         switch (stage) {
             case ParsingStage::CAMERA: {
-                if (line.length() > 0) {
-                    std::string param_header;
+                if (lineView.length() > 0) {
+                    std::string_view param_header;
                     double buffer[4];
-                    int no_params = parse_parameter_str(line,
+                    int no_params = parse_parameter_str(lineView,
                                                         param_header,
                                                         buffer,
                                                         4);
+                    if (no_params == -1) {
+                        return error("malformed camera parameter");
+                    }
 
+                    int expected = 1;
                     if (param_header == "position") {
-                        assert(no_params == 3);
+                        expected = 3;
                         camera.pos = {buffer[0], buffer[1], buffer[2]};
                     } else if (param_header == "orientation") {
-                        assert(no_params == 4);
+                        expected = 4;
                         camera.orientation = {buffer[0],
                                               buffer[1],
                                               buffer[2],
                                               buffer[3]};
                     } else if (param_header == "near") {
-                        assert(no_params == 1);
                         camera.near = buffer[0];
                     } else if (param_header == "far") {
-                        assert(no_params == 1);
                         camera.far = buffer[0];
                     } else if (param_header == "left") {
-                        assert(no_params == 1);
                         camera.left = buffer[0];
                     } else if (param_header == "right") {
-                        assert(no_params == 1);
                         camera.right = buffer[0];
                     } else if (param_header == "top") {
-                        assert(no_params == 1);
                         camera.top = buffer[0];
                     } else if (param_header == "bottom") {
-                        assert(no_params == 1);
                         camera.bottom = buffer[0];
                     } else {
-                        std::cout << "Error: ParsingStage::CAMERA" << std::endl;
-                        return false;
+                        return error("unknown camera parameter");
+                    }
+                    if (no_params != expected) {
+                        return error("wrong number of camera parameters");
                     }
                 } else {
-                    assert(line.length() == 0);
                     Eigen::Matrix4d perspectiveProj, worldToCameraProj;
                     makeWorldToCameraProj(worldToCameraProj, camera);
                     makePerspectiveProjection(perspectiveProj, camera);
@@ -90,53 +144,49 @@ bool parseDescription(const std::string& fname,
                 break;
             }
             case ParsingStage::LIGHTS: {
-                if (line.length() > 0) {
+                if (lineView.length() > 0) {
                     double buffer[3];
-                    std::string paramHeader;
-                    int firstCommaIdx = line.find(',');
+                    std::string_view paramHeader;
+                    size_t firstCommaIdx = lineView.find(',');
 
                     // handle case where scene description has no lights
-                    if (firstCommaIdx == std::string::npos) {
+                    if (firstCommaIdx == std::string_view::npos) {
                         stage = ParsingStage::OBJECTS;
                         continue;
                     }
-                    double secondCommaIdx = line.find(',', firstCommaIdx+1);
-                    assert(secondCommaIdx != std::string::npos);
+                    size_t secondCommaIdx = lineView.find(',', firstCommaIdx+1);
+                    if (secondCommaIdx == std::string_view::npos) {
+                        return error("expected 'light x y z , r g b , k'");
+                    }
 
                     PointLight light;
                     // parse light's position
-                    std::string light_pos_str = line.substr(0, firstCommaIdx);
-                    int no_params = parse_parameter_str(light_pos_str,
+                    int no_params = parse_parameter_str(lineView.substr(0, firstCommaIdx),
                                                         paramHeader,
                                                         buffer,
                                                         3);
-                    assert(no_params == 3);
+                    if (no_params != 3) {
+                        return error("malformed light position");
+                    }
                     light.pos = {buffer[0], buffer[1], buffer[2]};
-                    // std::cout << "light pos: " << light.pos.x << ' ' << light.pos.y << ' ' << light.pos.z << ' ' << std::endl;
-                    
+
                     // parse light's color
-                    std::string light_color_str = "color";
-                    light_color_str += line.substr(firstCommaIdx+1,
-                                                   secondCommaIdx-firstCommaIdx-2);
-                    no_params = parse_parameter_str(light_color_str,
-                                                    paramHeader,
-                                                    buffer,
-                                                    3);
-                    assert(no_params == 3);
-                    assert(paramHeader == "color");
+                    no_params = parse_numbers(lineView.substr(firstCommaIdx+1,
+                                                              secondCommaIdx-firstCommaIdx-1),
+                                              buffer,
+                                              3);
+                    if (no_params != 3) {
+                        return error("malformed light color");
+                    }
                     light.color = {buffer[0], buffer[1], buffer[2]};
-                    // std::cout << "light color: " << light.color.r << ' ' << light.color.g << ' ' << light.color.b << ' ' << std::endl;
 
                     // get light's attenuation parameter
-                    std::string atten_str = "attenuation";
-                    atten_str += line.substr(secondCommaIdx+1,
-                                             std::string::npos);
-                    no_params = parse_parameter_str(atten_str,
-                                                    paramHeader,
-                                                    buffer,
-                                                    1);
-                    assert(no_params == 1);
-                    assert(paramHeader == "attenuation");
+                    no_params = parse_numbers(lineView.substr(secondCommaIdx+1),
+                                              buffer,
+                                              1);
+                    if (no_params != 1) {
+                        return error("malformed light attenuation");
+                    }
                     light.attenuation = buffer[0];
 
                     lights.push_back(light);
@@ -147,85 +197,114 @@ bool parseDescription(const std::string& fname,
                 break;
             }
             case ParsingStage::OBJECTS: {
-                if (line.length() == 0) {
+                if (lineView.length() == 0) {
                     stage = ParsingStage::OBJECT_COPIES;
-                } else if (line == "objects:") {
+                } else if (lineView == "objects:") {
                     
                 } else {
-                    size_t spaceIdx = line.find(" ");
-                    assert(spaceIdx != std::string::npos);
-
-                    std::string label = line.substr(0, spaceIdx);
-                    std::string objFilename = line.substr(spaceIdx + 1, std::string::npos);
-                    std::shared_ptr<Object> obj =
-                        std::make_shared<Object>(objFilename, label, false);
+                    size_t spaceIdx = lineView.find(' ');
+                    if (spaceIdx == std::string_view::npos) {
+                        return error("expected 'label filename.obj'");
+                    }
 
-                    labelToObj.insert({label, obj});
+                    std::string label{lineView.substr(0, spaceIdx)};
+                    std::string objFilename{lineView.substr(spaceIdx + 1)};
+                    if (labelToObj.count(label) || pendingObjs.count(label)) {
+                        break;  // first definition of a label wins
+                    }
+                    pendingObjs.emplace(label, PendingObject{ThreadPool::shared().submit(
+                        [objFilename, label, loading, weldEpsilon]() mutable {
+                            return std::make_shared<Object>(objFilename, label, false,
+                                                            loading, weldEpsilon);
+                        }).share(), lineNo});
                 }
                 break;
             }
             case ParsingStage::OBJECT_COPIES: {
-                size_t spaceIdx = line.find(" ");
-                if (line.length() == 0) {  // finished copy, no more transformations
-                    objectCopies.back()->setMaterialProperties(ambient, diffuse,
+                size_t spaceIdx = lineView.find(' ');
+                if (lineView.length() == 0) {  // finished copy, no more transformations
+                    if (objectCopies.empty()) {
+                        break;
+                    }
+                    objectCopies.back().setMaterialProperties(ambient, diffuse,
                                                                specular, shininess);
-                    // objectCopies.back()->applyTransformation();
-                    // objectCopies.back()->applyNormalTransformation();
-                } else if (spaceIdx == std::string::npos) {  // create a new copy
-                    std::shared_ptr<Object> original = labelToObj.find(line)->second;
-                    std::shared_ptr<Object> copy
-                        = std::make_shared<Object>(*original);
-                    objectCopies.push_back(copy);
+                } else if (spaceIdx == std::string_view::npos) {  // create a new copy
+                    labelBuff.assign(lineView.data(), lineView.size());
+                    auto it = labelToObj.find(labelBuff);
+                    if (it == labelToObj.end()) {
+                        auto pending = pendingObjs.find(labelBuff);
+                        if (pending == pendingObjs.end()) {
+                            return error("copy of unknown object label");
+                        }
+                        if (!join(labelBuff, pending->second)) {
+                            return false;
+                        }
+                        pendingObjs.erase(pending);
+                        it = labelToObj.find(labelBuff);
+                    }
+                    objectCopies.emplace_back(it->second);
+                } else if (objectCopies.empty()) {
+                    return error("parameter precedes first object copy");
                 } else if (spaceIdx == 1) {  // new transformation matrix for the current copy
                     Eigen::Matrix4d transform;
-                    float transParams[4];
+                    float transParams[4] = {0, 0, 0, 0};
+                    Type tt;
 
-                    Type tt = makeMatrix(transform, line, transParams);
+                    if (!makeMatrix(transform, lineView, transParams, tt)) {
+                        return error("malformed transformation");
+                    }
                     if (tt == Type::ROTATION_MAT ||
                         tt == Type::SCALING_MAT) {
-                        objectCopies.back()->addNormalTransformation(transform);
+                        objectCopies.back().addNormalTransformation(transform);
                     }
-                    objectCopies.back()->addTransformation(transform);
-                    objectCopies.back()->recordTransformation(tt, transParams);
+                    objectCopies.back().addTransformation(transform);
+                    objectCopies.back().recordTransformation(tt, transParams);
                 } else {
-                    std::string paramHdr;
+                    std::string_view paramHdr;
                     double buffer[3];
-                    int no_params = parse_parameter_str(line,
+                    int no_params = parse_parameter_str(lineView,
                                                         paramHdr,
                                                         buffer,
                                                         3);
-                    if (paramHdr == "ambient") {
-                        assert(no_params == 3);
+                    int expected = 3;
+                    if (no_params == -1) {
+                        return error("malformed material parameter");
+                    } else if (paramHdr == "ambient") {
                         ambient = {buffer[0], buffer[1], buffer[2]};
                     } else if (paramHdr == "diffuse") {
-                        assert(no_params == 3);
                         diffuse = {buffer[0], buffer[1], buffer[2]}; 
                     } else if (paramHdr == "specular") {
-                        assert(no_params == 3);
                         specular = {buffer[0], buffer[1], buffer[2]}; 
                     } else if (paramHdr == "shininess") {
-                        assert(no_params == 1);
+                        expected = 1;
                         shininess = buffer[0];
                     } else {
-                        std::cout << "ERROR: unexpected parameter" << std::endl;
-                        assert(false);
+                        return error("unexpected parameter");
+                    }
+                    if (no_params != expected) {
+                        return error("wrong number of material parameters");
                     }
                 }
                 break;
             }
         }
         std::getline(file, line);
+        lineNo++;
     }
 
     if (objectCopies.size() > 0) {
-        objectCopies.back()->setMaterialProperties(ambient, diffuse,
+        objectCopies.back().setMaterialProperties(ambient, diffuse,
                                                    specular, shininess);
-        // objectCopies.back()->applyTransformation();
-        // objectCopies.back()->applyNormalTransformation();
+    }
+
+    // objects that were never copied
+    for (auto& pending : pendingObjs) {
+        if (!join(pending.first, pending.second)) {
+            return false;
+        }
     }
 
     return true;
 }
 
 #endif
-
@@ -0,0 +1,148 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Eigen"
+#include "Types.hpp"
+#include "Util.hpp"
+#include "Rasterizer.hpp"
+#include "ThreadPool.hpp"
+
+/* Triangles resolved out of the .obj's index lists; 3 entries per triangle. */
+struct TriangleBatch {
+    std::vector<Vertex> positions;
+    std::vector<Vertex> normals;
+};
+
+/* Output of the transform and lighting stage; 3 entries per triangle. */
+struct ShadedBatch {
+    std::vector<ShadedVertex> corners;
+};
+
+/* Fills 'out' with the corners of the triangles of 'in' that survive
+   back-face culling, transformed and lit. */
+inline void shadeBatch(TriangleBatch& in, ShadedBatch& out, const Material& material,
+                       ShadingAlgo alg, std::vector<PointLight>& lights,
+                       const Vertex& cameraPos, const Eigen::Matrix4d& worldToHomoNDC) {
+    out.corners.clear();
+    out.corners.reserve(in.positions.size());
+    for (size_t i = 0; i + 2 < in.positions.size(); i += 3) {
+        Vertex* n = &in.normals[i];
+        if (n[0].x == 0 && n[0].y == 0 && n[0].z == 0) {  // flat
+            const Vertex* v = &in.positions[i];
+            Eigen::Vector3d A{v[1].x - v[0].x, v[1].y - v[0].y, v[1].z - v[0].z};
+            Eigen::Vector3d B{v[2].x - v[0].x, v[2].y - v[0].y, v[2].z - v[0].z};
+            Eigen::Vector3d fn = A.cross(B).normalized();
+            n[0] = n[1] = n[2] = {fn(0), fn(1), fn(2)};
+        }
+        ShadedVertex sv[3];
+        if (shadeTriangle(&in.positions[i], n, material, alg,
+                          lights, cameraPos, worldToHomoNDC, sv)) {
+            out.corners.insert(out.corners.end(), sv, sv + 3);
+        }
+    }
+}
+
+/**
+ * One-shot render of 'objFname' straight from disk. The calling thread
+ * parses the file into batches of triangles as their faces are read; each
+ * time 'queueDepth' batches are ready, they are transformed, back-face
+ * culled and lit in parallel on ThreadPool::shared(), and then rasterized
+ * in file order by the calling thread. Only the .obj's vertex and normal
+ * lists and the batches in flight are kept while reading, and nothing is
+ * kept afterwards.
+ *
+ * Every call parses the file again, so a scene with several copies of a
+ * LOAD_STREAMED mesh parses it once per copy and frame.
+ *
+ * Faces without normals are flat shaded, since area-weighted vertex
+ * normals would need the whole mesh before the first face could be lit.
+*/
+void streamShadedOBJ(const std::string& objFname, const Material& material,
+                     ShadingAlgo alg, std::vector<PointLight>& lights,
+                     const Vertex& cameraPos,
+                     const Eigen::Matrix4d& worldToHomoNDC,
+                     std::vector<std::vector<Color>>& screenGrid,
+                     size_t xres, size_t yres,
+                     std::vector<std::vector<double>>& minDepth,
+                     size_t batchSize = 4096, size_t queueDepth = 8) {
+    std::vector<TriangleBatch> parsed(queueDepth);
+    std::vector<ShadedBatch> shaded(queueDepth);
+    size_t numParsed = 0;
+    auto flush = [&] {
+        ThreadPool::shared().parallelFor(numParsed, 1, [&](size_t lo, size_t hi) {
+            for (size_t b = lo; b < hi; b++) {
+                shadeBatch(parsed[b], shaded[b], material, alg, lights,
+                           cameraPos, worldToHomoNDC);
+            }
+        });
+        for (size_t b = 0; b < numParsed; b++) {
+            const std::vector<ShadedVertex>& corners = shaded[b].corners;
+            for (size_t i = 0; i + 2 < corners.size(); i += 3) {
+                rasterizeTriangle(&corners[i], material, alg, lights,
+                                  cameraPos, screenGrid, xres, yres, minDepth);
+            }
+            parsed[b].positions.clear();
+            parsed[b].normals.clear();
+        }
+        numParsed = 0;
+    };
+
+    std::ifstream file{objFname};
+    std::string line;
+    std::vector<Vertex> vertices(1), normals(1);  // 1-indexed, normals[0] = 0
+    while (std::getline(file, line)) {
+        std::string_view rest{line};
+        std::string_view hdr;
+        if (!next_token(rest, hdr)) {
+            continue;
+        }
+        double buff[3];
+        if (hdr == "v" || hdr == "vn") {
+            if (parse_numbers(rest, buff, 3) != 3) {
+                throw std::runtime_error(objFname + ": malformed " + std::string{hdr});
+            }
+            (hdr == "v" ? vertices : normals).push_back({buff[0], buff[1], buff[2]});
+        } else if (hdr == "f") {
+            TriangleBatch& batch = parsed[numParsed];
+            std::string_view token;
+            int corner = 0;
+            Vertex p[3], n[3];
+            while (next_token(rest, token)) {
+                int vi, ni;
+                if (!parseFaceCorner(token, vertices.size() - 1,
+                                     normals.size() - 1, vi, ni)) {
+                    throw std::runtime_error(objFname + ": malformed face");
+                }
+                if (vi < 1 || (size_t) vi >= vertices.size() ||
+                    ni < 0 || (size_t) ni >= normals.size()) {
+                    throw std::runtime_error(objFname + ": face index out of range");
+                }
+                if (corner == 3) {  // fan out polygons
+                    p[1] = p[2];
+                    n[1] = n[2];
+                    corner = 2;
+                }
+                p[corner] = vertices[vi];
+                n[corner] = normals[ni];
+                if (++corner == 3) {
+                    batch.positions.insert(batch.positions.end(), p, p + 3);
+                    batch.normals.insert(batch.normals.end(), n, n + 3);
+                }
+            }
+            if (batch.positions.size() >= 3*batchSize && ++numParsed == queueDepth) {
+                flush();
+            }
+        }
+    }
+    if (!parsed[numParsed].positions.empty()) {
+        numParsed++;
+    }
+    flush();
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef RASTERIZER_HPP
+#define RASTERIZER_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include "Eigen"
+#include "Types.hpp"
+#include "Lights.hpp"
+#include "Transformations.hpp"
+
+/** One triangle corner after the transform and lighting steps. */
+struct ShadedVertex {
+    Vertex world;
+    Vertex normal;
+    Vertex ndc;
+    Color color;  // only filled in for GOURAUD
+};
+
+/** @brief Transform step for one vertex of an indexed mesh; see lightVertex. */
+inline ShadedVertex projectVertex(const Vertex& v, const Vertex& n,
+                                  const Eigen::Matrix4d& worldToHomoNDC) {
+    ShadedVertex out;
+    out.world = v;
+    out.normal = n;
+    out.ndc = worldToNDC(worldToHomoNDC, v);
+    out.color = {0, 0, 0};
+    return out;
+}
+
+/** @brief Lighting step for a projected vertex; only GOURAUD needs one. */
+inline void lightVertex(ShadedVertex& sv, const Material& m, ShadingAlgo alg,
+                        std::vector<PointLight>& lights,
+                        const Vertex& cameraPos) {
+    if (alg == ShadingAlgo::GOURAUD) {
+        sv.color = LightingModel(sv.world, sv.normal, m.diffuse, m.ambient,
+                                 m.specular, m.shininess, lights, cameraPos);
+    }
+}
+
+/**
+ * Lights and projects the corners of the triangle ('v', 'n') into 'out'.
+ *
+ * @return false if the triangle is back-facing and should be skipped.
+*/
+inline bool shadeTriangle(const Vertex* v, const Vertex* n,
+                          const Material& m, ShadingAlgo alg,
+                          std::vector<PointLight>& lights,
+                          const Vertex& cameraPos,
+                          const Eigen::Matrix4d& worldToHomoNDC,
+                          ShadedVertex* out) {
+    for (int k = 0; k < 3; k++) {
+        out[k].world = v[k];
+        out[k].normal = n[k];
+        out[k].ndc = worldToNDC(worldToHomoNDC, v[k]);
+    }
+    if (isBackFacing(out[0].ndc, out[1].ndc, out[2].ndc)) {
+        return false;
+    }
+    if (alg == ShadingAlgo::GOURAUD) {
+        for (int k = 0; k < 3; k++) {
+            out[k].color = LightingModel(v[k], n[k], m.diffuse, m.ambient,
+                                         m.specular, m.shininess, lights,
+                                         cameraPos);
+        }
+    }
+    return true;
+}
+
+/** @brief Scan-converts one shaded triangle, depth testing against 'minDepth'. */
+inline void rasterizeTriangle(const ShadedVertex* sv, const Material& m,
+                              ShadingAlgo alg,
+                              std::vector<PointLight>& lights,
+                              const Vertex& cameraPos,
+                              std::vector<std::vector<Color>>& screenGrid,
+                              size_t xres, size_t yres,
+                              std::vector<std::vector<double>>& minDepth) {
+    const Vertex& v1 = sv[0].world;
+    const Vertex& v2 = sv[1].world;
+    const Vertex& v3 = sv[2].world;
+    const Vertex& n1 = sv[0].normal;
+    const Vertex& n2 = sv[1].normal;
+    const Vertex& n3 = sv[2].normal;
+    const Vertex& v1_ndc = sv[0].ndc;
+    const Vertex& v2_ndc = sv[1].ndc;
+    const Vertex& v3_ndc = sv[2].ndc;
+    const Color& c1 = sv[0].color;
+    const Color& c2 = sv[1].color;
+    const Color& c3 = sv[2].color;
+
+    std::pair<int, int> v1_sc = NDCtoScreen(v1_ndc, xres, yres);
+    std::pair<int, int> v2_sc = NDCtoScreen(v2_ndc, xres, yres);
+    std::pair<int, int> v3_sc = NDCtoScreen(v3_ndc, xres, yres);
+
+    size_t x_min = std::min({v1_sc.first, v2_sc.first, v3_sc.first});
+    size_t y_min = std::min({v1_sc.second, v2_sc.second, v3_sc.second});
+    size_t x_max = std::max({v1_sc.first, v2_sc.first, v3_sc.first});
+    size_t y_max = std::max({v1_sc.second, v2_sc.second, v3_sc.second});
+
+    for (size_t x = x_min; x <= x_max; x++) {
+        for (size_t y = y_min; y <= y_max; y++) {
+            double alpha = f_ij(x, y,
+                                v2_sc.first, v2_sc.second,
+                                v3_sc.first, v3_sc.second) /
+                           f_ij(v1_sc.first, v1_sc.second,
+                                v2_sc.first, v2_sc.second,
+                                v3_sc.first, v3_sc.second);
+            double beta = f_ij(x, y,
+                               v1_sc.first, v1_sc.second,
+                               v3_sc.first, v3_sc.second) /
+                           f_ij(v2_sc.first, v2_sc.second,
+                                v1_sc.first, v1_sc.second,
+                                v3_sc.first, v3_sc.second);
+            double gamma = f_ij(x, y,
+                                v1_sc.first, v1_sc.second,
+                                v2_sc.first, v2_sc.second) /
+                           f_ij(v3_sc.first, v3_sc.second,
+                                v1_sc.first, v1_sc.second,
+                                v2_sc.first, v2_sc.second);
+
+            if (0 <= alpha && alpha <= 1 &&
+                0 <= beta && beta <= 1 &&
+                0 <= gamma && gamma <= 1) {
+                Vertex interp_ndc = {alpha*v1_ndc.x + beta*v2_ndc.x + gamma*v3_ndc.x,
+                                     alpha*v1_ndc.y + beta*v2_ndc.y + gamma*v3_ndc.y,
+                                     alpha*v1_ndc.z + beta*v2_ndc.z + gamma*v3_ndc.z};
+                if (inNDCcube(interp_ndc) &&
+                    (interp_ndc.z < minDepth[x][y])) {
+                    minDepth[x][y] = interp_ndc.z;
+                    switch (alg) {
+                        case ShadingAlgo::GOURAUD: {
+                            double r = alpha*c1.r + beta*c2.r + gamma*c3.r;
+                            double g = alpha*c1.g + beta*c2.g + gamma*c3.g;
+                            double b = alpha*c1.b + beta*c2.b + gamma*c3.b;
+                            screenGrid[x][y] = {r, g, b};
+                            break;
+                        }
+                        case ShadingAlgo::PHONG: {
+                            double vx = alpha*v1.x + beta*v2.x + gamma*v3.x;
+                            double vy = alpha*v1.y + beta*v2.y + gamma*v3.y;
+                            double vz = alpha*v1.z + beta*v2.z + gamma*v3.z;
+                            Vertex v_interp = {vx, vy, vz};
+
+                            double nx = alpha*n1.x + beta*n2.x + gamma*n3.x;
+                            double ny = alpha*n1.y + beta*n2.y + gamma*n3.y;
+                            double nz = alpha*n1.z + beta*n2.z + gamma*n3.z;
+                            double norm = std::sqrt(nx*nx + ny*ny + nz*nz);
+
+                            Vertex n_interp = {nx/norm, ny/norm, nz/norm};
+                            screenGrid[x][y] = LightingModel(v_interp, n_interp,
+                                                             m.diffuse, m.ambient,
+                                                             m.specular, m.shininess,
+                                                             lights, cameraPos);
+                            break;
+                        }
+                        case ShadingAlgo::NONE:
+                            break;  // depth only
+                        default:
+                            assert(false);
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif
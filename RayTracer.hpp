@@ -0,0 +1,337 @@
+#ifndef RAY_TRACER_HPP
+#define RAY_TRACER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "Eigen"
+#include "Types.hpp"
+#include "Lights.hpp"
+#include "Transformations.hpp"
+#include "Instance.hpp"
+#include "ThreadPool.hpp"
+#include "BVH.hpp"
+
+/**
+ * Progressive ray tracer with hard shadows from the scene's point lights,
+ * shaded by the same LightingModel and materials as the rasterizer. Copies
+ * are placed in world space by their transformations, as in the OpenGL
+ * viewer, and gathered into one TriangleBVH.
+ *
+ * The image is rendered in square tiles spread over ThreadPool::shared().
+ * Within a tile, rays travel in packets of 4 x 2 pixels, stored as Eigen
+ * arrays one lane per ray, so box and triangle tests run on all of them at
+ * once; the shadow rays towards each light are traced as packets too.
+ * Every renderPass() adds one sample per pixel: the first through pixel
+ * centers, so a complete image is there after one pass, and the next at
+ * Halton offsets inside the pixels, which antialiases edges over time.
+*/
+class RayTracer {
+public:
+    static const int PACKET_WIDTH = 4;
+    static const int PACKET_HEIGHT = 2;
+    static const int PACKET = PACKET_WIDTH*PACKET_HEIGHT;
+    static const size_t TILE = 16;  // pixels on a side; a multiple of the packet
+
+    RayTracer(const std::vector<Instance>& copies, const std::vector<PointLight>& lights_,
+              const Camera& camera_, size_t xres_, size_t yres_)
+        : lights{lights_}, camera{camera_}, xres{xres_}, yres{yres_}
+    {
+        for (const Instance& copy : copies) {
+            const Eigen::Matrix4d& m = copy.getTransformation();
+            Eigen::Matrix3d normalMatrix = m.block<3, 3>(0, 0).inverse().transpose();
+            uint32_t copyIndex = materials.size();
+            materials.push_back(copy.material);
+            copy.getObject().forEachTriangle([&](const Vertex* v, const Vertex* n) {
+                for (int k = 0; k < 3; k++) {
+                    Eigen::Vector4d p = m*Eigen::Vector4d(v[k].x, v[k].y, v[k].z, 1);
+                    Eigen::Vector3d q = normalMatrix*Eigen::Vector3d(n[k].x, n[k].y, n[k].z);
+                    scene.corners.push_back(p.head<3>().cast<float>());
+                    normals.push_back(q.normalized().cast<float>());
+                }
+                triangleCopy.push_back(copyIndex);
+            });
+        }
+        scene.build();
+
+        // Shadow rays leave surfaces this far, to miss the surface itself
+        if (!scene.bvh.empty()) {
+            const AABB& box = scene.bvh.nodes[0].box;
+            bias = 1e-4f*(box.hi - box.lo).norm();
+        }
+        Eigen::Matrix4d R;
+        makeRotationMat(R, camera.orientation.x, camera.orientation.y,
+                        camera.orientation.z, camera.orientation.theta);
+        cameraToWorld = R.block<3, 3>(0, 0);
+        reset();
+    }
+
+    /** @brief Drops the samples taken so far. */
+    void reset() {
+        accumulated.assign(xres*yres, Color{0, 0, 0});
+        numPasses = 0;
+    }
+
+    size_t passes() const {
+        return numPasses;
+    }
+
+    size_t numTriangles() const {
+        return scene.numTriangles();
+    }
+
+    /** @brief Adds one sample to every pixel. @return The passes so far. */
+    size_t renderPass() {
+        double jx = 0.5, jy = 0.5;
+        if (numPasses > 0) {
+            jx = radicalInverse(numPasses, 2);
+            jy = radicalInverse(numPasses, 3);
+        }
+        size_t tilesX = (xres + TILE - 1) / TILE, tilesY = (yres + TILE - 1) / TILE;
+        ThreadPool::shared().parallelFor(tilesX*tilesY, 1, [&](size_t lo, size_t hi) {
+            Scratch scratch;
+            scratch.visible.reserve(lights.size());
+            scratch.occluded.resize(lights.size());
+            for (size_t tile = lo; tile < hi; tile++) {
+                size_t x0 = (tile % tilesX)*TILE, y0 = (tile / tilesX)*TILE;
+                for (size_t y = y0; y < std::min(y0 + TILE, yres); y += PACKET_HEIGHT) {
+                    for (size_t x = x0; x < std::min(x0 + TILE, xres); x += PACKET_WIDTH) {
+                        renderPacket(x, y, jx, jy, scratch);
+                    }
+                }
+            }
+        });
+        return ++numPasses;
+    }
+
+    /** @brief Writes the mean of the samples so far into 'screen', which is
+     *         indexed [x][y] like the rasterizer's screen grid. */
+    void resolve(std::vector<std::vector<Color>>& screen) const {
+        double scale = numPasses > 0 ? 1.0 / numPasses : 0;
+        for (size_t x = 0; x < xres; x++) {
+            for (size_t y = 0; y < yres; y++) {
+                const Color& c = accumulated[y*xres + x];
+                screen[x][y] = {c.r*scale, c.g*scale, c.b*scale};
+            }
+        }
+    }
+
+private:
+    using Lanes = Eigen::Array<float, PACKET, 1>;
+    using LaneIds = Eigen::Array<int32_t, PACKET, 1>;
+    using LaneMask = Eigen::Array<bool, PACKET, 1>;
+
+    /* Rays in structure-of-arrays form. Inactive lanes have tMax < 0, so
+       no box or triangle test passes for them. */
+    struct RayPacket {
+        Lanes ox, oy, oz;
+        Lanes dx, dy, dz;
+        Lanes tMax;
+        LaneIds triangle;  // -1 until something is hit
+        Lanes u, v;
+    };
+
+    /* Per-thread buffers of renderPacket. */
+    struct Scratch {
+        std::vector<PointLight> visible;  // lights a shading point sees
+        std::vector<LaneMask> occluded;   // per light
+    };
+
+    static double radicalInverse(size_t i, size_t base) {
+        double f = 1, r = 0;
+        for (; i > 0; i /= base) {
+            f /= base;
+            r += f*(i % base);
+        }
+        return r;
+    }
+
+    /* Traces the primary packet with its corner at pixel (x, y), then one
+       shadow packet per light, and adds the shaded samples. */
+    void renderPacket(size_t x, size_t y, double jx, double jy,
+                      Scratch& scratch) {
+        const float INF = std::numeric_limits<float>::infinity();
+        RayPacket primary;
+        for (int lane = 0; lane < PACKET; lane++) {
+            size_t px = x + lane % PACKET_WIDTH, py = y + lane / PACKET_WIDTH;
+            Eigen::Vector3d eye(camera.left + (px + jx)/xres*(camera.right - camera.left),
+                                camera.bottom + (py + jy)/yres*(camera.top - camera.bottom),
+                                -camera.near);
+            Eigen::Vector3d d = cameraToWorld*eye;
+            primary.ox(lane) = camera.pos.x;
+            primary.oy(lane) = camera.pos.y;
+            primary.oz(lane) = camera.pos.z;
+            primary.dx(lane) = d.x();
+            primary.dy(lane) = d.y();
+            primary.dz(lane) = d.z();
+            primary.tMax(lane) = px < xres && py < yres ? INF : -1;
+        }
+        trace(primary, false);
+
+        // Shading points, nudged off the surface towards the viewer
+        Eigen::Vector3f point[PACKET], normal[PACKET], start[PACKET];
+        for (int lane = 0; lane < PACKET; lane++) {
+            int32_t t = primary.triangle(lane);
+            start[lane].setZero();
+            if (t < 0) {
+                continue;
+            }
+            Eigen::Vector3f d(primary.dx(lane), primary.dy(lane), primary.dz(lane));
+            float u = primary.u(lane), v = primary.v(lane);
+            const Eigen::Vector3f* c = &scene.corners[3*t];
+            const Eigen::Vector3f* n = &normals[3*t];
+            Eigen::Vector3f geometric = (c[1] - c[0]).cross(c[2] - c[0]).normalized();
+            normal[lane] = ((1 - u - v)*n[0] + u*n[1] + v*n[2]).normalized();
+            if (geometric.dot(d) > 0) {  // back side: shade it as two-sided
+                geometric = -geometric;
+                normal[lane] = -normal[lane];
+            }
+            point[lane] = (1 - u - v)*c[0] + u*c[1] + v*c[2];
+            start[lane] = point[lane] + bias*geometric;
+        }
+
+        for (size_t l = 0; l < lights.size(); l++) {
+            RayPacket shadow;
+            Eigen::Vector3f target = Eigen::Vector3d(lights[l].pos.x, lights[l].pos.y,
+                                                     lights[l].pos.z).cast<float>();
+            for (int lane = 0; lane < PACKET; lane++) {
+                Eigen::Vector3f d = target - start[lane];
+                shadow.ox(lane) = start[lane].x();
+                shadow.oy(lane) = start[lane].y();
+                shadow.oz(lane) = start[lane].z();
+                shadow.dx(lane) = d.x();
+                shadow.dy(lane) = d.y();
+                shadow.dz(lane) = d.z();
+                shadow.tMax(lane) = primary.triangle(lane) >= 0 ? 1 : -1;  // up to the light
+            }
+            trace(shadow, true);
+            scratch.occluded[l] = shadow.triangle >= 0;
+        }
+
+        for (int lane = 0; lane < PACKET; lane++) {
+            int32_t t = primary.triangle(lane);
+            if (t < 0) {
+                continue;  // background stays black
+            }
+            scratch.visible.clear();
+            for (size_t l = 0; l < lights.size(); l++) {
+                if (!scratch.occluded[l](lane)) {
+                    scratch.visible.push_back(lights[l]);
+                }
+            }
+            const Material& m = materials[triangleCopy[t]];
+            Vertex p = {point[lane].x(), point[lane].y(), point[lane].z()};
+            Vertex n = {normal[lane].x(), normal[lane].y(), normal[lane].z()};
+            Color c = LightingModel(p, n, m.diffuse, m.ambient, m.specular, m.shininess,
+                                    scratch.visible, camera.pos);
+            Color& sum = accumulated[(y + lane / PACKET_WIDTH)*xres + x + lane % PACKET_WIDTH];
+            sum.r += c.r;
+            sum.g += c.g;
+            sum.b += c.b;
+        }
+    }
+
+    /* Finds each lane's nearest hit, or with 'anyHit' any hit, which then
+       ends the lane. Children are visited nearest entry first, and a node
+       is skipped once every lane has a hit closer than its entry. */
+    void trace(RayPacket& r, bool anyHit) const {
+        const BVH& bvh = scene.bvh;
+        const float INF = std::numeric_limits<float>::infinity();
+        r.triangle.setConstant(-1);
+        if (bvh.empty()) {
+            return;
+        }
+        Lanes ix = r.dx.inverse(), iy = r.dy.inverse(), iz = r.dz.inverse();
+        auto enter = [&](const AABB& b) {
+            Lanes x0 = (b.lo.x() - r.ox)*ix, x1 = (b.hi.x() - r.ox)*ix;
+            Lanes y0 = (b.lo.y() - r.oy)*iy, y1 = (b.hi.y() - r.oy)*iy;
+            Lanes z0 = (b.lo.z() - r.oz)*iz, z1 = (b.hi.z() - r.oz)*iz;
+            Lanes tNear = x0.min(x1).max(y0.min(y1)).max(z0.min(z1)).max(0.0f);
+            Lanes tFar = x0.max(x1).min(y0.max(y1)).min(z0.max(z1)).min(r.tMax);
+            return (tNear <= tFar).select(tNear, INF).minCoeff();
+        };
+
+        uint32_t stack[BVH::MAX_DEPTH + 1];
+        float entry[BVH::MAX_DEPTH + 1];
+        int size = 0;
+        float t = enter(bvh.nodes[0].box);
+        if (t < INF) {
+            stack[size] = 0;
+            entry[size++] = t;
+        }
+        while (size > 0) {
+            --size;
+            if (entry[size] > r.tMax.maxCoeff()) {
+                continue;
+            }
+            const BVH::Node& n = bvh.nodes[stack[size]];
+            if (n.isLeaf()) {
+                for (uint32_t k = n.start; k < n.start + n.count; k++) {
+                    intersect(r, bvh.order[k], anyHit);
+                }
+                if (anyHit && (r.tMax < 0).all()) {
+                    return;
+                }
+                continue;
+            }
+            float tLeft = enter(bvh.nodes[n.start].box);
+            float tRight = enter(bvh.nodes[n.start + 1].box);
+            uint32_t nearer = n.start, farther = n.start + 1;
+            if (tRight < tLeft) {
+                std::swap(tLeft, tRight);
+                std::swap(nearer, farther);
+            }
+            if (tRight < INF) {
+                stack[size] = farther;
+                entry[size++] = tRight;
+            }
+            if (tLeft < INF) {
+                stack[size] = nearer;
+                entry[size++] = tLeft;
+            }
+        }
+    }
+
+    /* Moller-Trumbore against every lane at once; see intersectTriangle. */
+    void intersect(RayPacket& r, uint32_t id, bool anyHit) const {
+        const Eigen::Vector3f& a = scene.corners[3*id];
+        Eigen::Vector3f e1 = scene.corners[3*id + 1] - a, e2 = scene.corners[3*id + 2] - a;
+        Lanes px = r.dy*e2.z() - r.dz*e2.y();
+        Lanes py = r.dz*e2.x() - r.dx*e2.z();
+        Lanes pz = r.dx*e2.y() - r.dy*e2.x();
+        Lanes det = e1.x()*px + e1.y()*py + e1.z()*pz;
+        Lanes invDet = det.inverse();
+        Lanes sx = r.ox - a.x(), sy = r.oy - a.y(), sz = r.oz - a.z();
+        Lanes u = (sx*px + sy*py + sz*pz)*invDet;
+        Lanes qx = sy*e1.z() - sz*e1.y();
+        Lanes qy = sz*e1.x() - sx*e1.z();
+        Lanes qz = sx*e1.y() - sy*e1.x();
+        Lanes v = (r.dx*qx + r.dy*qy + r.dz*qz)*invDet;
+        Lanes t = (e2.x()*qx + e2.y()*qy + e2.z()*qz)*invDet;
+        LaneMask hit = (det.abs() >= 1e-12f) && (u >= 0) && (v >= 0) && (u + v <= 1) &&
+                       (t > 0) && (t < r.tMax);
+        if (!hit.any()) {
+            return;
+        }
+        r.tMax = hit.select(anyHit ? Lanes::Constant(-1) : t, r.tMax);
+        r.triangle = hit.select(LaneIds::Constant(id), r.triangle);
+        r.u = hit.select(u, r.u);
+        r.v = hit.select(v, r.v);
+    }
+
+    TriangleBVH scene;                    // world space
+    std::vector<Eigen::Vector3f> normals; // world space, 3 per triangle
+    std::vector<uint32_t> triangleCopy;   // per triangle, into 'materials'
+    std::vector<Material> materials;      // per copy
+    std::vector<PointLight> lights;
+    Camera camera;
+    Eigen::Matrix3d cameraToWorld;
+    const size_t xres, yres;
+    float bias{0};
+    std::vector<Color> accumulated;  // sums of samples, [y*xres + x]
+    size_t numPasses{0};
+};
+
+#endif
@@ -1,103 +1,245 @@
 #ifndef SCENE_HPP
 #define SCENE_HPP
 
+#include <algorithm>
 #include <string>
 #include <limits>
+#include <memory>
+#include <stdexcept>
 #include <unordered_map>
 #include "Objects.hpp"
+#include "Instance.hpp"
 #include "Transformations.hpp"
 #include "Parser.hpp"
 #include "Lights.hpp"
+#include "Impostor.hpp"
+#include "AdaptiveSubdivision.hpp"
+#include "RayTracer.hpp"
+#include "ShadowMaps.hpp"
 
 class Scene {
 public:
-    Scene(const std::string& sceneDescriptionFname, size_t xres_, size_t yres_)
+    /** @param loading LOAD_STREAMED suits one-shot renders of scenes with
+     *                 one copy per mesh: each copy's mesh is parsed while it
+     *                 is being rasterized, and not kept.
+     *  @param weldEpsilon Vertices of a mesh this close are welded as it
+     *                     is loaded; 0 welds exact duplicates only. */
+    Scene(const std::string& sceneDescriptionFname, size_t xres_, size_t yres_,
+          MeshLoading loading = MeshLoading::LOAD_EAGER, double weldEpsilon = 0)
         : xres{xres_}, yres{yres_}
     {
-        // Build Camera, base Objects, and Object-Copies (i.e. transformed Objects)
-        assert(parseDescription(sceneDescriptionFname,
-                                labelToObj,
-                                objectCopies,
-                                lights,
-                                camera,
-                                worldToHomoNDC));
+        // Build Camera, base Objects, and Object-Copies (i.e. Instances of Objects)
+        if (!parseDescription(sceneDescriptionFname,
+                              labelToObj,
+                              objectCopies,
+                              lights,
+                              camera,
+                              worldToHomoNDC,
+                              loading,
+                              weldEpsilon)) {
+            throw std::runtime_error("Failed parsing " + sceneDescriptionFname);
+        }
     }
     
     /** @brief Outputs to stdout a PPM of the image. */
     void wireframePPM() {
-        const size_t ncols = xres;
-        
-        std::vector<std::vector<bool>> screenCoords{yres, std::vector<bool>(xres)};
+        Bitplane& screenCoords = frameCoverage;
+        screenCoords.reset(yres, xres);
 
-        for (std::shared_ptr<Object> obj : objectCopies) {
-            obj->fillScreenCoords(screenCoords, xres, yres);
+        for (const Instance& obj : objectCopies) {
+            obj.renderWireframe(screenCoords, xres, yres);
         }
 
         std::string c1 = "0 0 0";  // "85 47 130";   // purple
         std::string c2 = "253 185 39";  // gold
-        // output pixel grid to stdout as PPM
+        // output pixel grid to stdout as PPM, flushing once at the end
         std::cout << "P3" << std::endl;  // PPM header
         std::cout << yres << " " << xres << std::endl;
         std::cout << "255" << std::endl;
-        for (int32_t col = xres; col >= 0; col--) {
+        for (int32_t col = xres - 1; col >= 0; col--) {
             for (int32_t row = 0; row < yres; row++) {
-                if (screenCoords[row][col]) {
-                    std::cout << c2 << std::endl;
+                if (screenCoords.get(row, col)) {
+                    std::cout << c2 << '\n';
                 } else {
-                    std::cout << c1 << std::endl;
+                    std::cout << c1 << '\n';
                 }
             }
         }
+        std::cout.flush();
     }
 
     void renderShadedScene(ShadingAlgo shadingAlgo) {
-        std::vector<std::vector<Color>> screen{yres, std::vector<Color>{xres}};
+        std::vector<std::vector<Color>>& screen = frameColor;
+        std::vector<std::vector<double>>& minDepth = frameDepth;
+        if (screen.empty()) {
+            screen.assign(yres, std::vector<Color>(xres));
+            minDepth.assign(yres, std::vector<double>(xres));
+        }
+        for (size_t row = 0; row < yres; row++) {
+            std::fill(screen[row].begin(), screen[row].end(), Color{0, 0, 0});
+            std::fill(minDepth[row].begin(), minDepth[row].end(),
+                      std::numeric_limits<double>::max());
+        }
 
-        std::vector<double> defaultRow;
-        for (size_t i = 0; i < xres; i++) {
-            defaultRow.push_back(std::numeric_limits<double>::max());
+        std::vector<PointLight>* frameLights = &lights;
+        if (shadows.getSettings().enabled) {
+            size_t builds = shadows.getStats().builds;
+            shadows.update(lights, objectCopies, shadowedLights);
+            frameLights = &shadowedLights;
+            if (shadows.getStats().builds != builds) {
+                impostors.clear();  // sprites were lit with the old maps
+            }
         }
-        std::vector<std::vector<double>> minDepth{yres, defaultRow};
 
-        for (std::shared_ptr<Object> obj : objectCopies) {
-            obj->renderShadedObj(screen, xres, yres, shadingAlgo, lights,
-                                 camera.pos, worldToHomoNDC, minDepth);
+        for (const Instance& obj : objectCopies) {
+            size_t level = selectLOD(obj);
+            if (impostors.getSettings().enabled &&
+                impostors.draw(obj, level, shadingAlgo, *frameLights, camera,
+                               worldToHomoNDC, screen, minDepth, xres, yres)) {
+                continue;
+            }
+            if (level == 0 && subdivision.getSettings().enabled &&
+                subdivision.draw(obj, shadingAlgo, *frameLights, camera.pos,
+                                 worldToHomoNDC, screen, minDepth, xres, yres)) {
+                continue;
+            }
+            obj.renderShadedObj(screen, xres, yres, shadingAlgo, *frameLights,
+                                 camera.pos, worldToHomoNDC, minDepth, level);
         }
+        writePPM(screen);
+    }
 
-        // output screen to stdout in PPM format
-        std::cout << "P3" << std::endl;  // PPM header
-        std::cout << yres << " " << xres << std::endl;
-        std::cout << "255" << std::endl;
-        for (int32_t col = xres; col >= 0; col--) {
-            for (int32_t row = 0; row < yres; row++) {
-                uint32_t r = 255*screen[row][col].r;
-                uint32_t g = 255*screen[row][col].g;
-                uint32_t b = 255*screen[row][col].b;
-                std::cout << r << " " << g << " " << b << std::endl;
+    /**
+     * Outputs to stdout a PPM of the scene ray traced with hard shadows
+     * (see RayTracer), averaging 'passes' samples per pixel. With
+     * 'everyPass', a PPM is written after each pass, so a viewer reading
+     * the stream shows the image as it refines.
+    */
+    void rayTraceScene(size_t passes, bool everyPass = false) {
+        std::vector<std::vector<Color>>& screen = frameColor;
+        if (screen.empty()) {
+            screen.assign(yres, std::vector<Color>(xres));
+            frameDepth.assign(yres, std::vector<double>(xres));
+        }
+        if (!rayTracer) {
+            rayTracer = std::make_unique<RayTracer>(objectCopies, lights, camera, xres, yres);
+        }
+        rayTracer->reset();
+        for (size_t pass = 0; pass < passes; pass++) {
+            rayTracer->renderPass();
+            if (everyPass || pass + 1 == passes) {
+                rayTracer->resolve(screen);
+                writePPM(screen);
             }
         }
     }
 
-    std::vector<std::shared_ptr<Object>> getObjects() {
+    const std::vector<Instance>& getObjects() const {
         return objectCopies;
     }
 
-    Camera getCamera() {
+    const Camera& getCamera() const {
         return camera;
     }
 
-    std::vector<PointLight> getLights() {
+    const std::vector<PointLight>& getLights() const {
         return lights;
     }
 
+    /** @brief Replaces the point lights; shadow maps of lights that moved
+     *         are redrawn by the next renderShadedScene, and impostor
+     *         sprites, which bake in the lighting, are dropped. */
+    void setLights(const std::vector<PointLight>& lights_) {
+        lights = lights_;
+        rayTracer.reset();
+        impostors.clear();
+    }
+
+    /** @brief Sets how many pixels of error a simplified LOD level may
+     *         show before a finer one is drawn; LOAD_LOD only. */
+    void setLODPixelError(double pixels) {
+        lodPixelError = pixels;
+    }
+
+    /** @brief Enables or configures impostors for distant copies in
+     *         renderShadedScene; drops the sprites cached so far. */
+    void setImpostorSettings(const ImpostorSettings& settings) {
+        impostors.setSettings(settings);
+    }
+
+    ImpostorCache::Stats getImpostorStats() const {
+        return impostors.getStats();
+    }
+
+    /** @brief Enables or configures adaptive Loop subdivision of close-up
+     *         copies in renderShadedScene; drops the patches cached so far. */
+    void setSubdivisionSettings(const SubdivisionSettings& settings) {
+        subdivision.setSettings(settings);
+    }
+
+    SubdivisionCache::Stats getSubdivisionStats() const {
+        return subdivision.getStats();
+    }
+
+    /** @brief Enables or configures cube shadow maps of the point lights in
+     *         renderShadedScene; drops the maps and impostor sprites cached
+     *         so far. */
+    void setShadowSettings(const ShadowSettings& settings) {
+        shadows.setSettings(settings);
+        impostors.clear();
+    }
+
+    ShadowMapCache::Stats getShadowStats() const {
+        return shadows.getStats();
+    }
+
+    /** @return Level of the copy's LOD chain to draw, 0 if it has none.
+     *          Like every software render path, it takes the copy to be
+     *          where its Object's geometry is, ignoring its transformation. */
+    size_t selectLOD(const Instance& copy) const {
+        std::shared_ptr<const LODMesh> lod = copy.getObject().getLODMesh();
+        if (!lod) {
+            return 0;
+        }
+        return selectLODLevel(*lod, Eigen::Matrix4d::Identity(), camera,
+                              xres, yres, lodPixelError);
+    }
+
 private:
+    /* Writes 'screen' to stdout as a PPM, flushing once at the end. */
+    void writePPM(const std::vector<std::vector<Color>>& screen) const {
+        std::cout << "P3" << std::endl;  // PPM header
+        std::cout << yres << " " << xres << std::endl;
+        std::cout << "255" << std::endl;
+        for (int32_t col = xres - 1; col >= 0; col--) {
+            for (int32_t row = 0; row < yres; row++) {
+                uint32_t r = 255*screen[row][col].r;
+                uint32_t g = 255*screen[row][col].g;
+                uint32_t b = 255*screen[row][col].b;
+                std::cout << r << " " << g << " " << b << '\n';
+            }
+        }
+        std::cout.flush();
+    }
+
     std::unordered_map<std::string, std::shared_ptr<Object>> labelToObj;
-    std::vector<std::shared_ptr<Object>> objectCopies;
+    std::vector<Instance> objectCopies;
     std::vector<PointLight> lights;
     Eigen::Matrix4d worldToHomoNDC;
     Camera camera;
     const size_t xres, yres;
+
+    // Frame buffers, allocated by the first render and reused after that
+    Bitplane frameCoverage;
+    std::vector<std::vector<Color>> frameColor;
+    std::vector<std::vector<double>> frameDepth;
     ShadingAlgo shadingAlgo{ShadingAlgo::NONE};
+    double lodPixelError{1.0};
+    ImpostorCache impostors;
+    SubdivisionCache subdivision;
+    std::unique_ptr<RayTracer> rayTracer;  // built by the first rayTraceScene
+    ShadowMapCache shadows;
+    std::vector<PointLight> shadowedLights;  // 'lights' with their shadow maps
 };
 
 #endif
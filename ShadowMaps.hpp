@@ -0,0 +1,234 @@
+#ifndef SHADOW_MAPS_HPP
+#define SHADOW_MAPS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_set>
+#include <vector>
+#include "Eigen"
+#include "Types.hpp"
+#include "Lights.hpp"
+#include "Rasterizer.hpp"
+#include "Instance.hpp"
+#include "ThreadPool.hpp"
+#include "CubeShadowMap.hpp"
+
+/** Configuration of ShadowMapCache; see Scene::setShadowSettings. */
+struct ShadowSettings {
+    bool enabled{false};
+    size_t resolution{512};          // texels on a side of each cube face
+    double minIntensity{1.0 / 256};  // a light reaches as far as its attenuation
+                                     // leaves it this bright
+    double bias{0.01};               // relative depth difference still lit
+};
+
+/**
+ * Cube shadow maps of the scene's point lights for the software renderer.
+ * Each map is rasterized from the copies within the light's reach, six
+ * faces in parallel, by rasterizeTriangle in depth-only mode; triangles are
+ * clipped to each face's frustum first, and drawn two-sided so open meshes
+ * cast shadows too. Like the renderer, copies are drawn where their
+ * Object's geometry is, so copies of one Object are drawn once.
+ *
+ * A map is kept until its light moves, or changes attenuation, or the
+ * copies within its reach change.
+*/
+class ShadowMapCache {
+public:
+    struct Stats {
+        size_t builds;
+        size_t reuses;
+    };
+
+    void setSettings(const ShadowSettings& settings_) {
+        settings = settings_;
+        clear();
+    }
+
+    const ShadowSettings& getSettings() const {
+        return settings;
+    }
+
+    Stats getStats() const {
+        return stats;
+    }
+
+    void clear() {
+        entries.clear();
+    }
+
+    /**
+     * Fills 'shadowed' with 'lights', each pointing at its shadow map,
+     * rebuilding the maps that are out of date. The pointers stay valid
+     * until the next update() or clear().
+    */
+    void update(const std::vector<PointLight>& lights, const std::vector<Instance>& copies,
+                std::vector<PointLight>& shadowed) {
+        entries.resize(lights.size());
+        shadowed = lights;
+        for (size_t i = 0; i < lights.size(); i++) {
+            const PointLight& light = lights[i];
+            Entry& entry = entries[i];
+            std::vector<const Instance*> inReach;
+            double far = reach(light, copies, inReach);
+            if (entry.built && entry.light.pos.x == light.pos.x &&
+                entry.light.pos.y == light.pos.y && entry.light.pos.z == light.pos.z &&
+                entry.light.attenuation == light.attenuation && entry.copies == inReach) {
+                stats.reuses++;
+            } else {
+                entry.light = light;
+                entry.copies = inReach;
+                build(entry, far);
+                entry.built = true;
+                stats.builds++;
+            }
+            shadowed[i].shadow = entry.copies.empty() ? nullptr : &entry.map;
+        }
+    }
+
+private:
+    struct Entry {
+        bool built{false};
+        PointLight light;
+        std::vector<const Instance*> copies;  // within reach when built
+        CubeShadowMap map;
+    };
+
+    /* Collects the copies whose bounding spheres come within the light's
+       reach. @return The farthest any of them extends from the light. */
+    double reach(const PointLight& light, const std::vector<Instance>& copies,
+                 std::vector<const Instance*>& inReach) const {
+        double limit = std::numeric_limits<double>::infinity();
+        if (light.attenuation > 0) {
+            limit = std::sqrt((1 / settings.minIntensity - 1) / light.attenuation);
+        }
+        double far = 0;
+        for (const Instance& copy : copies) {
+            Vertex c;
+            double r;
+            if (!copy.getObject().getBoundingSphere(c, r)) {
+                continue;  // streamed: keeps no geometry to draw
+            }
+            double dx = c.x - light.pos.x, dy = c.y - light.pos.y, dz = c.z - light.pos.z;
+            double d = std::sqrt(dx*dx + dy*dy + dz*dz);
+            if (d - r < limit) {
+                inReach.push_back(&copy);
+                far = std::max(far, d + r);
+            }
+        }
+        return far;
+    }
+
+    void build(Entry& entry, double far) const {
+        const size_t res = settings.resolution;
+        const Vertex& pos = entry.light.pos;
+        entry.map.reset(pos, res, 1e-4*far, far, settings.bias);
+        if (entry.copies.empty()) {
+            return;
+        }
+
+        std::vector<Vertex> triangles;
+        std::unordered_set<const Object*> drawn;
+        for (const Instance* copy : entry.copies) {
+            const Object& object = copy->getObject();
+            if (drawn.insert(&object).second) {
+                object.forEachTriangle([&](const Vertex* v, const Vertex*) {
+                    triangles.insert(triangles.end(), v, v + 3);
+                });
+            }
+        }
+
+        ThreadPool::shared().parallelFor(CubeShadowMap::FACES, 1, [&](size_t lo, size_t hi) {
+            std::vector<std::vector<double>> minDepth(res, std::vector<double>(res));
+            std::vector<std::vector<Color>> unused;  // depth only: no colors
+            std::vector<PointLight> noLights;
+            Vertex eye = pos;
+            Material m{};
+            for (size_t face = lo; face < hi; face++) {
+                for (std::vector<double>& column : minDepth) {
+                    std::fill(column.begin(), column.end(),
+                              std::numeric_limits<double>::max());
+                }
+                Eigen::Matrix4d toHomoNDC = entry.map.faceToHomoNDC(face);
+                for (size_t t = 0; t < triangles.size(); t += 3) {
+                    drawClipped(&triangles[t], toHomoNDC, 1e-4*far, m, noLights, eye,
+                                unused, res, minDepth);
+                }
+                entry.map.storeFace(face, minDepth);
+            }
+        });
+    }
+
+    /* Rasterizes the depths of triangle 'v' after clipping it to the face's
+       frustum: its near plane (w = 'near' in homogeneous NDC), far plane
+       and four sides. Clipping the sides matters because rasterizeTriangle
+       clamps vertices off the face to its edge, which would squash the part
+       of an occluder that spans into a neighbouring face. */
+    static void drawClipped(const Vertex* v, const Eigen::Matrix4d& toHomoNDC, double near,
+                            const Material& m, std::vector<PointLight>& noLights,
+                            const Vertex& eye, std::vector<std::vector<Color>>& unused,
+                            size_t res, std::vector<std::vector<double>>& minDepth) {
+        // Each plane clips at most one vertex more onto a convex polygon
+        const int PLANES = 6;
+        Eigen::Vector4d polygon[3 + PLANES], clipped[3 + PLANES];
+        int size = 3;
+        for (int k = 0; k < 3; k++) {
+            polygon[k] = toHomoNDC*Eigen::Vector4d(v[k].x, v[k].y, v[k].z, 1);
+        }
+        // Signed distances, >= 0 inside: w >= near, |x| <= w, |y| <= w, z <= w
+        auto inside = [near](int plane, const Eigen::Vector4d& h) {
+            switch (plane) {
+                case 0: return h(3) - near;
+                case 1: return h(3) - h(0);
+                case 2: return h(3) + h(0);
+                case 3: return h(3) - h(1);
+                case 4: return h(3) + h(1);
+                default: return h(3) - h(2);
+            }
+        };
+        for (int plane = 0; plane < PLANES && size >= 3; plane++) {
+            int numInside = 0;
+            for (int k = 0; k < size; k++) {
+                numInside += inside(plane, polygon[k]) >= 0;
+            }
+            if (numInside == 0) {
+                return;  // wholly outside, the case for most faces
+            }
+            if (numInside == size) {
+                continue;
+            }
+            int out = 0;
+            for (int k = 0; k < size; k++) {
+                const Eigen::Vector4d& a = polygon[k];
+                const Eigen::Vector4d& b = polygon[(k + 1) % size];
+                double da = inside(plane, a), db = inside(plane, b);
+                if (da >= 0) {
+                    clipped[out++] = a;
+                }
+                if ((da >= 0) != (db >= 0)) {
+                    clipped[out++] = a + da / (da - db)*(b - a);
+                }
+            }
+            std::copy(clipped, clipped + out, polygon);
+            size = out;
+        }
+
+        for (int k = 1; k + 1 < size; k++) {
+            ShadedVertex sv[3];
+            const Eigen::Vector4d* corner[3] = {&polygon[0], &polygon[k], &polygon[k + 1]};
+            for (int j = 0; j < 3; j++) {
+                const Eigen::Vector4d& c = *corner[j];
+                sv[j].ndc = {c(0)/c(3), c(1)/c(3), c(2)/c(3)};
+            }
+            rasterizeTriangle(sv, m, ShadingAlgo::NONE, noLights, eye, unused,
+                              res, res, minDepth);
+        }
+    }
+
+    ShadowSettings settings;
+    std::vector<Entry> entries;  // per light
+    Stats stats{0, 0};
+};
+
+#endif
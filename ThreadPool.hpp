@@ -0,0 +1,154 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Fixed set of worker threads consuming a FIFO of tasks. Use
+ * ThreadPool::shared() rather than making pools per call site, so the
+ * process never runs more workers than there are hardware threads.
+*/
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t numThreads = std::thread::hardware_concurrency()) {
+        numThreads = std::max<size_t>(1, numThreads);
+        for (size_t i = 0; i < numThreads; i++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            stopping = true;
+        }
+        cv.notify_all();
+        for (std::thread& w : workers) {
+            w.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /** @brief Queues 'f'. Exceptions it throws are rethrown by future::get(). */
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F&& f) {
+        using R = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        std::future<R> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            tasks.emplace([task] { (*task)(); });
+        }
+        cv.notify_one();
+        return result;
+    }
+
+    /**
+     * Runs 'fn(lo, hi)' over [0, n) in blocks of 'grain' indices, on the
+     * workers and the calling thread. The caller only waits for blocks that
+     * are already running, never for queued tasks, so this is safe to call
+     * from inside a task of the same pool.
+    */
+    template <typename F>
+    void parallelFor(size_t n, size_t grain, F&& fn) {
+        grain = std::max<size_t>(1, grain);
+        size_t numBlocks = (n + grain - 1) / grain;
+        if (numBlocks <= 1) {
+            if (n > 0) {
+                fn(0, n);
+            }
+            return;
+        }
+
+        struct State {
+            std::atomic<size_t> next{0};
+            std::atomic<size_t> done{0};
+            std::mutex mtx;
+            std::condition_variable cv;
+            std::exception_ptr error;
+        };
+        auto state = std::make_shared<State>();
+        // helpers that start after the loop is over find no block and never
+        // touch 'fn'
+        auto work = [state, numBlocks, grain, n, &fn] {
+            size_t b;
+            while ((b = state->next++) < numBlocks) {
+                try {
+                    fn(b*grain, std::min(n, (b + 1)*grain));
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock{state->mtx};
+                    if (!state->error) {
+                        state->error = std::current_exception();
+                    }
+                }
+                if (++state->done == numBlocks) {
+                    std::lock_guard<std::mutex> lock{state->mtx};
+                    state->cv.notify_all();
+                }
+            }
+        };
+
+        size_t helpers = std::min(workers.size(), numBlocks - 1);
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            for (size_t i = 0; i < helpers; i++) {
+                tasks.emplace(work);
+            }
+        }
+        cv.notify_all();
+        work();
+
+        std::unique_lock<std::mutex> lock{state->mtx};
+        state->cv.wait(lock, [&] { return state->done == numBlocks; });
+        if (state->error) {
+            std::rethrow_exception(state->error);
+        }
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    static ThreadPool& shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock{mtx};
+                cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool stopping{false};
+};
+
+#endif
@@ -40,29 +40,38 @@ void makeScalingMat(Eigen::Matrix4d& m, double sx, double sy, double sz) {
          0,  0,  0,  1;
 }
 
+/**
+ * @brief Builds 'm' from a line of form "t tx ty tz", "r rx ry rz theta"
+ *        or "s sx sy sz". 'buffer' must hold 4 parameters.
+ * @return false if the line is not a well-formed transformation.
+ */
 template <typename T>
-Type makeMatrix(Eigen::Matrix4d& m, std::string& line, T* buffer) {
-    std::string param_header;
+bool makeMatrix(Eigen::Matrix4d& m, std::string_view line, T* buffer, Type& tt) {
+    std::string_view param_header;
 
     int param_count = parse_parameter_str(line, param_header, buffer, 4);
-    assert(-1 != param_count);
-    assert(param_header.length() == 1);
+    if (param_count == -1 || param_header.length() != 1) {
+        return false;
+    }
 
     switch ((char) param_header[0]) {
         case Type::TRANSLATION_MAT:
-            assert(param_count == 3);
+            if (param_count != 3) { return false; }
             makeTranslationMat(m, buffer[0], buffer[1], buffer[2]);
-            return Type::TRANSLATION_MAT;
+            tt = Type::TRANSLATION_MAT;
+            return true;
         case Type::ROTATION_MAT:
-            assert(param_count == 4);
+            if (param_count != 4) { return false; }
             makeRotationMat(m, buffer[0], buffer[1], buffer[2], buffer[3]);
-            return Type::ROTATION_MAT;
+            tt = Type::ROTATION_MAT;
+            return true;
         case Type::SCALING_MAT:
-            assert(param_count == 3);
+            if (param_count != 3) { return false; }
             makeScalingMat(m, buffer[0], buffer[1], buffer[2]);
-            return Type::SCALING_MAT;
+            tt = Type::SCALING_MAT;
+            return true;
         default:
-            assert(false);
+            return false;
     }
 }
 
@@ -101,7 +110,7 @@ void makePerspectiveProjection(Eigen::Matrix4d& perspectiveProj,
                          0,   0,   -1,  0;
 }
 
-inline Vertex worldToNDC(Eigen::Matrix4d& worldToHomoNDC, Vertex& v) {
+inline Vertex worldToNDC(const Eigen::Matrix4d& worldToHomoNDC, const Vertex& v) {
     // World Space
     Eigen::Vector4d V_ws;
     V_ws << v.x, v.y, v.z, 1;
@@ -118,7 +127,7 @@ inline Vertex worldToNDC(Eigen::Matrix4d& worldToHomoNDC, Vertex& v) {
     return {x_hndc/w_hndc, y_hndc/w_hndc, z_hndc/w_hndc};
 }
 
-inline std::pair<int, int> NDCtoScreen(Vertex& v1, size_t xres, size_t yres) {
+inline std::pair<int, int> NDCtoScreen(const Vertex& v1, size_t xres, size_t yres) {
     int v1_x = (int) (((v1.x - (-1)) / (1 - (-1))) * xres);
     int v1_y = (int) (((v1.y - (-1)) / (1 - (-1))) * yres);
     // if (std::abs(v1_x) > xres) {
@@ -132,7 +141,7 @@ inline std::pair<int, int> NDCtoScreen(Vertex& v1, size_t xres, size_t yres) {
     return std::make_pair(v1_x, v1_y);
 }
 
-bool isBackFacing(Vertex& v1, Vertex& v2, Vertex& v3) {
+bool isBackFacing(const Vertex& v1, const Vertex& v2, const Vertex& v3) {
     double ux = v3.x - v1.x;
     double uy = v3.y - v1.y;
     double rx = v1.x - v2.x;
@@ -154,7 +163,7 @@ double f_ij(double x, double y, double xi, double yi, double xj, double yj) {
     return (yi - yj)*x + (xj - xi)*y + xi*yj - xj*yi;
 }
 
-inline bool inNDCcube(Vertex& v) {
+inline bool inNDCcube(const Vertex& v) {
     return -1 <= v.x && v.x <= 1 &&
            -1 <= v.y && v.y <= 1 &&
            -1 <= v.z && v.z <= 1;
@@ -1,6 +1,9 @@
 #ifndef TYPES_HPP
 #define TYPES_HPP
 
+#include <cstddef>
+#include <vector>
+
 enum Type : char {
     VERTEX = 'v',
     FACE = 'f',
@@ -34,6 +37,13 @@ struct Color {
     double b;
 };
 
+struct Material {
+    Color ambient;
+    Color diffuse;
+    Color specular;
+    double shininess;
+};
+
 struct Orientation {
     double x, y, z, theta;
 };
@@ -44,10 +54,34 @@ struct Camera {
     double near, far, left, right, top, bottom;
 };
 
+class CubeShadowMap;
+
 struct PointLight {
     Vertex pos;
     Color color;
     double attenuation;
+    const CubeShadowMap* shadow{nullptr};  // occluders, if set; see ShadowMaps.hpp
+};
+
+/** Read-only, non-owning view of a contiguous array. Valid as long as the
+    array it was made from is alive and not resized. */
+template <typename T>
+class ConstView {
+public:
+    ConstView() = default;
+    ConstView(const T* data_, size_t size_) : ptr{data_}, count{size_} {}
+    ConstView(const std::vector<T>& v) : ptr{v.data()}, count{v.size()} {}
+
+    const T* data() const { return ptr; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T* begin() const { return ptr; }
+    const T* end() const { return ptr + count; }
+    const T& operator[](size_t i) const { return ptr[i]; }
+
+private:
+    const T* ptr{nullptr};
+    size_t count{0};
 };
 
 struct TransformationRecord {
@@ -1,8 +1,11 @@
 #ifndef UTIL_HPP
 #define UTIL_HPP
 
+#include <charconv>
+#include <iostream>
 #include <sstream>
 #include <string>
+#include <string_view>
 
 /**
  * @param str Has form "param_header param1 param2 param3 ..."
@@ -31,6 +34,95 @@ int parse_parameter_str(std::string& str,
     return count;
 };
 
+/**
+ * Splits the next whitespace-delimited token off the front of 'str'.
+ * Neither 'str' nor 'token' own memory, so nothing is allocated.
+ *
+ * @return false if 'str' has no tokens left.
+*/
+inline bool next_token(std::string_view& str, std::string_view& token) {
+    size_t begin = str.find_first_not_of(" \t\r\n");
+    if (begin == std::string_view::npos) {
+        str = {};
+        token = {};
+        return false;
+    }
+    size_t end = str.find_first_of(" \t\r\n", begin);
+    if (end == std::string_view::npos) {
+        end = str.size();
+    }
+    token = str.substr(begin, end - begin);
+    str.remove_prefix(end);
+    return true;
+}
+
+/** @return false unless all of 'token' is a number. */
+template <typename T>
+inline bool parse_number(std::string_view token, T& value) {
+    if (token.size() > 1 && token[0] == '+') {  // std::stod accepted it
+        token.remove_prefix(1);
+    }
+    const char* end = token.data() + token.size();
+    std::from_chars_result res = std::from_chars(token.data(), end, value);
+    return res.ec == std::errc() && res.ptr == end;
+}
+
+/**
+ * @param str Has form "param1 param2 param3 ..."
+ * @param buffer Populated from the tokens in str
+ *
+ * @return Number of parameters found, -1 if there are more than
+ *         buffer_size of them or one is not a number.
+*/
+template <typename T>
+int parse_numbers(std::string_view str, T* buffer, size_t buffer_size) {
+    std::string_view token;
+    size_t count = 0;
+    while (next_token(str, token)) {
+        if (count == buffer_size || !parse_number(token, buffer[count])) {
+            return -1;
+        }
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Allocation-free counterpart of parse_parameter_str above. 'param_header'
+ * is a view into 'str', so it is only valid as long as 'str' is.
+ *
+ * @return Number of parameters found, -1 on malformed input.
+*/
+template <typename T>
+int parse_parameter_str(std::string_view str,
+                        std::string_view& param_header,
+                        T* buffer,
+                        size_t buffer_size) {
+    if (!next_token(str, param_header)) { return -1; }
+    return parse_numbers(str, buffer, buffer_size);
+}
+
+/* Parses an .obj face corner of form "v", "v/t", "v//n" or "v/t/n".
+   Negative (relative) indices are resolved against the counts so far. */
+inline bool parseFaceCorner(std::string_view token, int numVertices,
+                            int numNormals, int& v, int& n) {
+    size_t slash = token.find('/');
+    if (!parse_number(token.substr(0, slash), v)) {
+        return false;
+    }
+    n = 0;
+    if (slash != std::string_view::npos) {
+        size_t slash2 = token.find('/', slash + 1);
+        if (slash2 != std::string_view::npos &&
+            !parse_number(token.substr(slash2 + 1), n)) {
+            return false;
+        }
+    }
+    if (v < 0) { v += numVertices + 1; }
+    if (n < 0) { n += numNormals + 1; }
+    return true;
+}
+
 /* Parses string of form 'f 1//1 2//1 3//1' into two buffers */
 int parseStrTwoBuff(std::string& str,
                     int* vBuff,
@@ -64,4 +156,11 @@ int parseStrTwoBuff(std::string& str,
     return count;
 }
 
+/* Prints "fname:lineNo: msg" to stderr. Always returns false. */
+inline bool reportParseError(const std::string& fname, size_t lineNo,
+                             const char* msg) {
+    std::cerr << fname << ":" << lineNo << ": " << msg << std::endl;
+    return false;
+}
+
 #endif
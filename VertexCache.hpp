@@ -0,0 +1,220 @@
+#ifndef VERTEX_CACHE_HPP
+#define VERTEX_CACHE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "IndexedMesh.hpp"
+
+namespace VertexCache {
+
+/* Size of the LRU cache modelled by optimizeVertexCache, and of the FIFO
+   cache computeACMR simulates; 32 is typical of current GPUs. */
+const int CACHE_SIZE = 32;
+
+/* Forsyth's scoring: vertices just used score a flat 0.75 so that strips
+   do not dominate, older cache entries decay, and vertices with few
+   triangles left are boosted so that no vertex is left stranded. */
+inline float vertexScore(int cachePosition, uint32_t remaining) {
+    if (remaining == 0) {
+        return -1;
+    }
+    float score = 0;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            score = 0.75f;
+        } else {
+            float age = (cachePosition - 3) / (float) (CACHE_SIZE - 3);
+            score = std::pow(1 - age, 1.5f);
+        }
+    }
+    return score + 2.0f / std::sqrt((float) remaining);
+}
+
+}  // namespace VertexCache
+
+/**
+ * @return Average cache miss ratio: vertices transformed per triangle when
+ *         drawing 'indices' through a FIFO post-transform cache of
+ *         'cacheSize' entries. 3 is the worst case; about 0.5 the best on a
+ *         closed mesh.
+*/
+double computeACMR(const std::vector<uint32_t>& indices, size_t numVertices,
+                   size_t cacheSize = VertexCache::CACHE_SIZE) {
+    if (indices.empty()) {
+        return 0;
+    }
+    // a vertex is cached if fewer than 'cacheSize' misses happened since
+    // its own
+    std::vector<size_t> missedAt(numVertices, 0);
+    size_t misses = 0;
+    for (uint32_t v : indices) {
+        if (missedAt[v] == 0 || misses - missedAt[v] >= cacheSize) {
+            misses++;
+            missedAt[v] = misses;
+        }
+    }
+    return misses / (double) (indices.size() / 3);
+}
+
+/**
+ * Reorders the triangles of 'indices' for the post-transform vertex cache,
+ * with Tom Forsyth's "Linear-Speed Vertex Cache Optimisation": greedily
+ * emit the triangle whose vertices score highest, rescoring only the
+ * triangles of vertices in the modelled cache. Linear in the number of
+ * triangles.
+*/
+void optimizeVertexCache(std::vector<uint32_t>& indices, size_t numVertices) {
+    using namespace VertexCache;
+    size_t numFaces = indices.size() / 3;
+
+    // Triangles of each vertex; the first 'remaining[v]' are not emitted yet
+    std::vector<uint32_t> remaining(numVertices, 0);
+    for (uint32_t v : indices) {
+        remaining[v]++;
+    }
+    std::vector<uint32_t> adjStart(numVertices + 1, 0);
+    for (size_t v = 0; v < numVertices; v++) {
+        adjStart[v + 1] = adjStart[v] + remaining[v];
+    }
+    std::vector<uint32_t> adj(indices.size());
+    {
+        std::vector<uint32_t> fill(adjStart.begin(), adjStart.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            adj[fill[indices[i]]++] = i / 3;
+        }
+    }
+
+    std::vector<int> cachePosition(numVertices, -1);
+    std::vector<float> score(numVertices);
+    for (size_t v = 0; v < numVertices; v++) {
+        score[v] = vertexScore(-1, remaining[v]);
+    }
+    std::vector<float> faceScore(numFaces);
+    for (size_t f = 0; f < numFaces; f++) {
+        faceScore[f] = score[indices[3*f]] + score[indices[3*f + 1]] +
+                       score[indices[3*f + 2]];
+    }
+    std::vector<char> emitted(numFaces, false);
+
+    std::vector<uint32_t> out;
+    out.reserve(indices.size());
+    uint32_t cache[CACHE_SIZE + 3];
+    int cacheCount = 0;
+    size_t nextUnemitted = 0;
+    long best = -1;
+
+    for (size_t n = 0; n < numFaces; n++) {
+        if (best < 0) {
+            // nothing in the cache has triangles left; rather than scoring
+            // every triangle (quadratic), take the next one in file order
+            while (emitted[nextUnemitted]) {
+                nextUnemitted++;
+            }
+            best = nextUnemitted;
+        }
+
+        const uint32_t* tri = &indices[3*best];
+        out.insert(out.end(), tri, tri + 3);
+        emitted[best] = true;
+
+        // The triangle's vertices move to the front of the LRU cache
+        uint32_t newCache[CACHE_SIZE + 3];
+        int newCount = 0;
+        for (int k = 0; k < 3; k++) {
+            newCache[newCount++] = tri[k];
+        }
+        for (int i = 0; i < cacheCount; i++) {
+            if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2]) {
+                newCache[newCount++] = cache[i];
+            }
+        }
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = tri[k];
+            uint32_t* first = &adj[adjStart[v]];
+            uint32_t* last = first + remaining[v];
+            std::iter_swap(std::find(first, last, (uint32_t) best), last - 1);
+            remaining[v]--;
+        }
+
+        // Rescore what was in or just fell out of the cache
+        for (int i = 0; i < newCount; i++) {
+            uint32_t v = newCache[i];
+            cachePosition[v] = i < CACHE_SIZE ? i : -1;
+            score[v] = vertexScore(cachePosition[v], remaining[v]);
+        }
+        best = -1;
+        float bestScore = -1;
+        for (int i = 0; i < newCount; i++) {
+            uint32_t v = newCache[i];
+            for (uint32_t j = adjStart[v]; j < adjStart[v] + remaining[v]; j++) {
+                uint32_t f = adj[j];
+                faceScore[f] = score[indices[3*f]] + score[indices[3*f + 1]] +
+                               score[indices[3*f + 2]];
+                if (faceScore[f] > bestScore) {
+                    bestScore = faceScore[f];
+                    best = f;
+                }
+            }
+        }
+        cacheCount = std::min(newCount, CACHE_SIZE);
+        std::copy(newCache, newCache + cacheCount, cache);
+    }
+    indices.swap(out);
+}
+
+/** @brief Renumbers the vertices of 'mesh' in order of first use, so that
+ *         drawing fetches them close to sequentially. */
+void optimizeVertexFetch(IndexedMesh& mesh) {
+    const uint32_t UNSEEN = UINT32_MAX;
+    std::vector<uint32_t> newIndex(mesh.vertices.size(), UNSEEN);
+    std::vector<IndexedVertex> vertices;
+    vertices.reserve(mesh.vertices.size());
+    for (uint32_t& v : mesh.indices) {
+        if (newIndex[v] == UNSEEN) {
+            newIndex[v] = vertices.size();
+            vertices.push_back(mesh.vertices[v]);
+        }
+        v = newIndex[v];
+    }
+    mesh.vertices.swap(vertices);
+}
+
+/** ACMR of a mesh's faces in file order and after reordering. */
+struct VertexCacheStats {
+    double acmrBefore;
+    double acmrAfter;
+};
+
+/**
+ * @brief Reorders the faces of 'mesh' for the vertex cache and its vertices
+ *        for fetch locality, then rebuilds its meshlets. If 'stats' is
+ *        given, the ACMR is measured before and after into it, at the cost
+ *        of two linear passes over the indices.
+*/
+void optimizeMeshForVertexCache(IndexedMesh& mesh, VertexCacheStats* stats = nullptr) {
+    if (stats) {
+        stats->acmrBefore = computeACMR(mesh.indices, mesh.vertices.size());
+    }
+    optimizeVertexCache(mesh.indices, mesh.vertices.size());
+    optimizeVertexFetch(mesh);
+    mesh.buildMeshlets();
+    if (stats) {
+        stats->acmrAfter = computeACMR(mesh.indices, mesh.vertices.size());
+    }
+}
+
+/** An IndexedMesh whose faces and vertices were reordered at load time;
+    cached apart from the file-order IndexedMesh of the same file. */
+struct CacheOptimizedMesh : IndexedMesh {
+    VertexCacheStats stats{0, 0};  // measured when it was loaded
+};
+
+void loadOBJ(const std::string& fname, CacheOptimizedMesh& mesh, double weldEpsilon = 0) {
+    loadOBJ(fname, static_cast<IndexedMesh&>(mesh), weldEpsilon);
+    optimizeMeshForVertexCache(mesh, &mesh.stats);
+}
+
+#endif
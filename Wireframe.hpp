@@ -0,0 +1,294 @@
+#ifndef WIREFRAME_HPP
+#define WIREFRAME_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include "Types.hpp"
+
+/**
+ * Coverage of a wireframe render, one bit per pixel packed into 64-bit
+ * words, indexed like the screenCoords grid: plane.get(a, b) is
+ * screenCoords[a][b]. set() is an atomic OR, so threads can draw lines into
+ * the same plane concurrently; an image of 2000 x 2000 pixels is 500 KB.
+*/
+class Bitplane {
+public:
+    /** @brief Sizes the plane to 'rows' x 'cols' and clears every bit,
+     *         reusing the words if the size did not change. */
+    void reset(size_t rows, size_t cols) {
+        size_t needed = (rows*cols + 63) / 64;
+        if (needed != numWords) {
+            words.reset(new std::atomic<uint64_t>[needed]);
+            numWords = needed;
+        }
+        numRows = rows;
+        numCols = cols;
+        for (size_t i = 0; i < numWords; i++) {
+            words[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void set(size_t a, size_t b) {
+        assert(a < numRows && b < numCols);
+        size_t i = a*numCols + b;
+        words[i / 64].fetch_or(uint64_t{1} << (i % 64), std::memory_order_relaxed);
+    }
+
+    /**
+     * Sets bits through one pending word, which is ORed into the plane when
+     * a bit of another word is set, or by flush(). Consecutive pixels of a
+     * line mostly share a word, so this saves most of the atomic operations.
+     * One per thread; flush() before reading the plane.
+    */
+    class Writer {
+    public:
+        explicit Writer(Bitplane& plane_) : plane{plane_} {}
+
+        ~Writer() {
+            flush();
+        }
+
+        void set(size_t a, size_t b) {
+            assert(a < plane.numRows && b < plane.numCols);
+            size_t i = a*plane.numCols + b;
+            if (i / 64 != word) {
+                flush();
+                word = i / 64;
+            }
+            bits |= uint64_t{1} << (i % 64);
+        }
+
+        void flush() {
+            if (bits) {
+                plane.words[word].fetch_or(bits, std::memory_order_relaxed);
+                bits = 0;
+            }
+        }
+
+    private:
+        Bitplane& plane;
+        size_t word{0};
+        uint64_t bits{0};
+    };
+
+    bool get(size_t a, size_t b) const {
+        size_t i = a*numCols + b;
+        return (words[i / 64].load(std::memory_order_relaxed) >> (i % 64)) & 1;
+    }
+
+    size_t rows() const {
+        return numRows;
+    }
+
+    size_t cols() const {
+        return numCols;
+    }
+
+private:
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+    size_t numWords{0};
+    size_t numRows{0};
+    size_t numCols{0};
+};
+
+namespace Wireframe {
+
+/* Bresenham for 0 <= slope <= 1 (in the possibly flipped frame), i0 <= i1. */
+template <typename Plot>
+void rasterizeLinePosSlope(int32_t i0, int32_t j0, int32_t i1, int32_t j1,
+                           bool flipped_x_and_y, Plot&& plot) {
+    int32_t eps = 0;
+    int32_t y = j0;
+    int32_t delta_x = i1 - i0;
+    assert(delta_x >= 0);
+    int32_t delta_y = j1 - j0;
+    assert(delta_y >= 0);  // positive slope
+
+    // special case
+    if (i0 == i1) {
+        for (int32_t y = j0; y <= j1; y++) {
+            if (flipped_x_and_y) {
+                plot(i0, y);
+            } else {
+                plot(y, i0);
+            }
+        }
+        return;
+    }
+
+    for (int32_t x = i0; x <= i1; x++) {
+        if (flipped_x_and_y) {
+            plot(x, y);
+        } else {
+            plot(y, x);
+        }
+
+        int32_t val = (eps + delta_y) << 1;
+        if (val < delta_x) {
+            eps += delta_y;
+        } else {
+            eps += (delta_y - delta_x);
+            y++;
+        }
+    }
+}
+
+/* Bresenham for -1 <= slope < 0 (in the possibly flipped frame), i0 <= i1. */
+template <typename Plot>
+void rasterizeLineNegSlope(int32_t i0, int32_t j0, int32_t i1, int32_t j1,
+                           bool flipped_x_and_y, Plot&& plot) {
+    int32_t eps = 0;
+    int32_t y = j0;
+    int32_t neg_delta_x = i0 - i1;
+    assert(neg_delta_x <= 0);
+    int32_t delta_y = j1 - j0;
+    assert(delta_y < 0);
+
+    // special case
+    if (i0 == i1) {
+        for (int32_t y = j0; y <= j1; y++) {
+            if (flipped_x_and_y) {
+                plot(i0, y);
+            } else {
+                plot(y, i0);
+            }
+        }
+        return;
+    }
+
+    for (int32_t x = i0; x <= i1; x++) {
+        if (flipped_x_and_y) {
+            plot(x, y);
+        } else {
+            plot(y, x);
+        }
+
+        int32_t val = (eps + delta_y) << 1;
+        if (val < neg_delta_x) {
+            eps += delta_y - neg_delta_x;  // delta_y + delta_x
+            y--;
+        } else {
+            eps += delta_y;
+        }
+    }
+}
+
+/**
+ * Calls 'plot(a, b)' for every cell screenCoords[a][b] of the line from
+ * (x0, y0) to (x1, y1). The endpoints are put in a canonical order first,
+ * so a line covers the same cells whichever way it is drawn. Cells keep y
+ * pointing up; Scene::wireframePPM flips the image as it writes it.
+*/
+template <typename Plot>
+void drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1, Plot&& plot) {
+    int32_t delta_x = x1 - x0;
+    int32_t delta_y = y1 - y0;
+
+    int32_t i_left, j_left, i_right, j_right;  // implementation: i_left <= i_right
+
+    // if slope > 1 ==> flip x and y to make 0<=slope<=1
+    bool flip_x_and_y = std::abs(delta_x) < std::abs(delta_y);
+    if (flip_x_and_y) {
+        if (delta_y >= 0) {
+            i_left = y0;
+            j_left = x0;
+            i_right = y1;
+            j_right = x1;
+        } else {
+            i_left = y1;
+            j_left = x1;
+            i_right = y0;
+            j_right = x0;
+        }
+    } else {
+        if (delta_x >= 0) {
+            i_left = x0;
+            j_left = y0;
+            i_right = x1;
+            j_right = y1;
+        } else {
+            i_left = x1;
+            j_left = y1;
+            i_right = x0;
+            j_right = y0;
+        }
+    }
+
+    if (j_left <= j_right) {
+        rasterizeLinePosSlope(i_left, j_left, i_right, j_right, flip_x_and_y, plot);
+    } else {
+        rasterizeLineNegSlope(i_left, j_left, i_right, j_right, flip_x_and_y, plot);
+    }
+}
+
+/* Pixel of an NDC point, clamped to the screen. */
+inline void toPixel(const Vertex& v, size_t xres, size_t yres, int32_t& x, int32_t& y) {
+    x = (int32_t) (((v.x - (-1)) / (1 - (-1))) * xres);
+    y = (int32_t) (((v.y - (-1)) / (1 - (-1))) * yres);
+    x = std::min(std::max(0, x), (int32_t) xres-1);
+    y = std::min(std::max(0, y), (int32_t) yres-1);
+}
+
+/** @brief Draws the segment from 'a' to 'b', both in NDC, as the edge of a
+ *         wireframe triangle. */
+template <typename Plot>
+void drawEdge(const Vertex& a, const Vertex& b, size_t xres, size_t yres, Plot&& plot) {
+    int32_t ax, ay, bx, by;
+    toPixel(a, xres, yres, ax, ay);
+    toPixel(b, xres, yres, bx, by);
+    drawLine(ay, ax, by, bx, plot);
+}
+
+}  // namespace Wireframe
+
+/**
+ * @return Each edge of the triangles in 'indices' once, as pairs of vertex
+ *         indices (lower first). Halfedges are bucketed on their lower
+ *         vertex, as in HalfedgeMesh, so this is linear in the number of
+ *         triangles and works on any mesh, manifold or not.
+*/
+std::vector<uint32_t> uniqueEdges(const std::vector<uint32_t>& indices, size_t numVertices) {
+    std::vector<uint32_t> bucketStart(numVertices + 1, 0);
+    auto forEachHalfedge = [&](auto&& fn) {
+        for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+            for (int k = 0; k < 3; k++) {
+                uint32_t a = indices[t + k], b = indices[t + (k + 1) % 3];
+                if (a != b) {
+                    fn(std::min(a, b), std::max(a, b));
+                }
+            }
+        }
+    };
+    forEachHalfedge([&](uint32_t low, uint32_t) { bucketStart[low + 1]++; });
+    for (size_t v = 0; v < numVertices; v++) {
+        bucketStart[v + 1] += bucketStart[v];
+    }
+    std::vector<uint32_t> high(bucketStart.back());
+    {
+        std::vector<uint32_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+        forEachHalfedge([&](uint32_t low, uint32_t h) { high[fill[low]++] = h; });
+    }
+
+    std::vector<uint32_t> edges;
+    edges.reserve(high.size());  // exact on a closed mesh, where each edge has two
+    for (size_t v = 0; v < numVertices; v++) {
+        uint32_t* first = high.data() + bucketStart[v];
+        uint32_t* last = high.data() + bucketStart[v + 1];
+        std::sort(first, last);
+        for (uint32_t* h = first; h != last; h++) {
+            if (h == first || *h != h[-1]) {
+                edges.push_back(v);
+                edges.push_back(*h);
+            }
+        }
+    }
+    edges.shrink_to_fit();
+    return edges;
+}
+
+#endif
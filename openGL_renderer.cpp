@@ -1,7 +1,7 @@
 #include "openGL_renderer.hpp"
 
 void extract_parameters(Scene& scene) {
-    Camera camera = scene.getCamera();
+    const Camera& camera = scene.getCamera();
     cam_orientation_angle = (float) camera.orientation.theta * 180.0 / M_PI;
     cam_orientation_axis[0] = (float) camera.orientation.x;
     cam_orientation_axis[1] = (float) camera.orientation.y;
@@ -18,6 +18,21 @@ void extract_parameters(Scene& scene) {
 
     lights = scene.getLights();
     objects = scene.getObjects();
+
+    // Draw straight from each Object's IndexedMesh; other layouts are
+    // converted once here, rather than every frame
+    for (const Instance& copy : objects) {
+        const Object& obj = copy.getObject();
+        if (object_buffers.count(&obj)) {
+            continue;
+        }
+        std::shared_ptr<const IndexedMesh> buffers = obj.getIndexedMesh();
+        if (!buffers) {
+            buffers = std::make_shared<IndexedMesh>(makeIndexedMesh(obj.copyMesh()));
+        }
+        object_buffers[&obj] = buffers;
+    }
+    scene_bvh.build(objects, SceneBVH::TWO_LEVEL);
 }
 
 void init() {
@@ -73,8 +88,8 @@ void draw_objects() {
     for (int i = 0; i < objects.size(); i++) {
         glPushMatrix();
         {
-        for (int j = objects[i]->transSeq.size() - 1; j  >= 0; j--) {
-            TransformationRecord tr = objects[i]->transSeq[j];
+        for (int j = objects[i].transSeq.size() - 1; j  >= 0; j--) {
+            TransformationRecord tr = objects[i].transSeq[j];
             switch (tr.tt) {
                 case Type::TRANSLATION_MAT: {
                     glTranslatef(tr.params[0], tr.params[1], tr.params[2]);
@@ -97,59 +112,28 @@ void draw_objects() {
 
         }
 
-        float ambient_reflect[3] = {(float) objects[i]->ambient.r,
-                                    (float) objects[i]->ambient.g,
-                                    (float) objects[i]->ambient.b};
-        float diffuse_reflect[3] = {(float) objects[i]->diffuse.r,
-                                    (float) objects[i]->diffuse.g,
-                                    (float) objects[i]->diffuse.b};
-        float specular_reflect[3] = {(float) objects[i]->specular.r,
-                                     (float) objects[i]->specular.g,
-                                     (float) objects[i]->specular.b};
+        float ambient_reflect[3] = {(float) objects[i].material.ambient.r,
+                                    (float) objects[i].material.ambient.g,
+                                    (float) objects[i].material.ambient.b};
+        float diffuse_reflect[3] = {(float) objects[i].material.diffuse.r,
+                                    (float) objects[i].material.diffuse.g,
+                                    (float) objects[i].material.diffuse.b};
+        float specular_reflect[3] = {(float) objects[i].material.specular.r,
+                                     (float) objects[i].material.specular.g,
+                                     (float) objects[i].material.specular.b};
         glMaterialfv(GL_FRONT, GL_AMBIENT, ambient_reflect);
         glMaterialfv(GL_FRONT, GL_DIFFUSE, diffuse_reflect);
         glMaterialfv(GL_FRONT, GL_SPECULAR, specular_reflect);
-        glMaterialf(GL_FRONT, GL_SHININESS, (float) objects[i]->shininess);
+        glMaterialf(GL_FRONT, GL_SHININESS, (float) objects[i].material.shininess);
         
-        // Draw vertices & normals (use 1-index to skip dummy)
-        std::vector<Vertex> vertices = objects[i]->getVertices();
-        std::vector<Vertex> normals = objects[i]->getNormals();
-        std::vector<Face> faces = objects[i]->getFaces();
-        std::vector<Float3> vertex_buffer;
-        std::vector<Float3> normal_buffer;
-        for (Face face : faces) {
-            Vertex v1 = vertices[face.v.i1];
-            Float3 v1f = {(float) v1.x, (float) v1.y, (float) v1.z};
-            Vertex v2 = vertices[face.v.i2];
-            Float3 v2f = {(float) v2.x, (float) v2.y, (float) v2.z};
-            Vertex v3 = vertices[face.v.i3];
-            Float3 v3f = {(float) v3.x, (float) v3.y, (float) v3.z};
-            vertex_buffer.push_back(v1f);
-            vertex_buffer.push_back(v2f);
-            vertex_buffer.push_back(v3f);
-
-            if (vertices.size() == normals.size()) {  // TODO: handle case of different parsing modes better this is when normals are specified
-              Vertex n1 = normals[face.n.i1];
-              Float3 n1f = {(float) n1.x, (float) n1.y, (float) n1.z};
-              Vertex n2 = normals[face.n.i2];
-              Float3 n2f = {(float) n2.x, (float) n2.y, (float) n2.z};
-              Vertex n3 = normals[face.n.i3];
-              Float3 n3f = {(float) n3.x, (float) n3.y, (float) n3.z};
-              normal_buffer.push_back(n1f);
-              normal_buffer.push_back(n2f);
-              normal_buffer.push_back(n3f);
-            }
+        // Draw vertices & normals
+        const IndexedMesh& buffers = *object_buffers.at(&objects[i].getObject());
+        if (!buffers.indices.empty()) {
+            glVertexPointer(3, GL_FLOAT, sizeof(IndexedVertex), &buffers.vertices[0].px);
+            glNormalPointer(GL_FLOAT, sizeof(IndexedVertex), &buffers.vertices[0].nx);
+            glDrawElements(GL_TRIANGLES, buffers.indices.size(), GL_UNSIGNED_INT,
+                           buffers.indices.data());
         }
-        if (vertices.size() != normals.size()) {
-            for (int i = 1; i < normals.size(); i++) {
-              Vertex n1 = normals[i];
-              Float3 n1f = {(float) n1.x, (float) n1.y, (float) n1.z};
-              normal_buffer.push_back(n1f);
-            }
-        }
-        glVertexPointer(3, GL_FLOAT, 0, &vertex_buffer[0]);
-        glNormalPointer(GL_FLOAT, 0, &normal_buffer[0]);
-        glDrawArrays(GL_TRIANGLES, 0, vertex_buffer.size());
         }
 
         glPopMatrix();
@@ -196,6 +180,7 @@ void display() {
     //           << " " << cam_position[2] << std::endl;
     // inverse camera translation
     glTranslatef(-cam_position[0], -cam_position[1], -cam_position[2]);
+    glGetDoublev(GL_MODELVIEW_MATRIX, view_matrix);
 
     set_lights();
     draw_objects();
@@ -208,6 +193,8 @@ void reshape(int width, int height) {
     height = height == 0 ? 1 : height;
 
     glViewport(0, 0, width, height);
+    window_width = width;
+    window_height = height;
 
     mouse_scale_x = (float) (cam_right - cam_left) / (float) width;
     mouse_scale_y = (float) (cam_top - cam_bottom) / (float) height;
@@ -227,6 +214,28 @@ void mouse_pressed(int button, int state, int x, int y) {
         glutPostRedisplay();
 
         is_pressed = false;
+    } else if (button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN) {
+        pick(x, y);
+    }
+}
+
+/* Prints the object copy and face under window pixel (x, y), casting the
+   ray through it back into world space with the last frame's view. */
+void pick(int x, int y) {
+    Eigen::Vector3d eye(cam_left + (x + 0.5) / window_width * (cam_right - cam_left),
+                        cam_top - (y + 0.5) / window_height * (cam_top - cam_bottom),
+                        -cam_near);
+    Eigen::Matrix4d toWorld = Eigen::Map<Eigen::Matrix4d>(view_matrix).inverse();
+    Eigen::Vector3d origin = toWorld.block<3, 1>(0, 3);
+    Eigen::Vector3d direction = toWorld.block<3, 3>(0, 0) * eye;
+
+    RayHit hit;
+    if (scene_bvh.intersect(origin, direction, hit)) {
+        Eigen::Vector3d point = origin + hit.t * direction;
+        std::cout << "picked copy " << hit.copy << ", face " << hit.face << " at "
+                  << point.x() << " " << point.y() << " " << point.z() << std::endl;
+    } else {
+        std::cout << "picked nothing" << std::endl;
     }
 }
 
@@ -3,12 +3,14 @@
 
 #include <cmath>
 #include <iostream>
+#include <unordered_map>
 #include <vector>
 
 #include "GL/glew.h"
 #include "GL/glut.h"
 #include "Scene.hpp"
 #include "Quaternion.hpp"
+#include "BVH.hpp"
 
 /*
 struct PointLight {
@@ -80,7 +82,16 @@ bool is_pressed{false};
 const float x_view_step = 90.0, y_view_step = 90.0;
 
 std::vector<PointLight> lights;
-std::vector<std::shared_ptr<Object>> objects;
+std::vector<Instance> objects;
+
+/* Vertex and index buffers drawn for each shared Object. */
+std::unordered_map<const Object*, std::shared_ptr<const IndexedMesh>> object_buffers;
+
+/* Copies' triangles for picking with the right mouse button, and the
+   world-to-eye matrix of the last frame it casts rays with. */
+SceneBVH scene_bvh;
+GLdouble view_matrix[16];
+int window_width{1}, window_height{1};
 
 void extract_parameters(Scene& scene);
 void init();
@@ -89,6 +100,7 @@ void display();
 void reshape(int width, int height);
 void mouse_pressed(int button, int state, int x, int y);
 void mouse_moved(int x, int y);
+void pick(int x, int y);
 // void key_pressed();
 
 #endif